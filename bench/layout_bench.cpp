@@ -0,0 +1,203 @@
+// Measures a full relayout of large trees without a window.
+//
+// usage: rubus-gui-bench [frames]
+//
+// "-1" variants only invalidate a single leaf per frame.
+//
+// On linux the cache misses of the layout are counted with perf events. (if the kernel allows it)
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <rubus-gui/tree.hpp>
+
+namespace {
+
+struct CacheMissCounter {
+  int fd = -1;
+
+  CacheMissCounter() {
+#ifdef __linux__
+    auto attr = perf_event_attr{};
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+  }
+
+  ~CacheMissCounter() {
+#ifdef __linux__
+    if (fd != -1) {
+      close(fd);
+    }
+#endif
+  }
+
+  auto start() -> void {
+#ifdef __linux__
+    if (fd != -1) {
+      ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  auto stop() -> std::int64_t {
+#ifdef __linux__
+    if (fd != -1) {
+      ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+      auto count = std::int64_t{};
+      if (read(fd, &count, sizeof(count)) == sizeof(count)) {
+        return count;
+      }
+    }
+#endif
+    return -1;
+  }
+};
+
+auto make_text(int i) -> std::string {
+  static const char *words[] = {"lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit"};
+  auto text = std::string{};
+  for (auto j = 0; j < 1 + i % 6; ++j) {
+    if (j != 0) {
+      text.push_back(' ');
+    }
+    text.append(words[(i + j) % 8]);
+  }
+  return text;
+}
+
+auto make_cell(int i) -> rugui::Node * {
+  if (i % 4 == 0) {
+    return new rugui::Node{"text", make_text(i)};
+  }
+  return (new rugui::Node{"cell"})
+    ->set_width(rugui::Size::Self(20 + (float)(i % 7) * 5))
+    ->set_height(rugui::Size::FitContent())
+    ->set_padding(2)
+    ->set_margin(1)
+    ->add((new rugui::Node{"leaf"})->set_width(rugui::Size::Parent(1))->set_height(rugui::Size::Self(10)));
+}
+
+// Few children per node, many levels.
+auto build_deep(rugui::Node *parent, int depth, int &count) -> void {
+  if (depth == 0) {
+    parent->add(make_cell(count++));
+    return;
+  }
+  for (auto i = 0; i < 2; ++i) {
+    auto node = (new rugui::Node{"group"})
+                  ->set_width(rugui::Size::FitContent())
+                  ->set_height(rugui::Size::FitContent())
+                  ->set_padding(1)
+                  ->set_flex_dir(i % 2 == 0 ? rugui::FlexDir::Row : rugui::FlexDir::Col);
+    parent->add(node);
+    ++count;
+    build_deep(node, depth - 1, count);
+  }
+}
+
+// Many children per node, few levels.
+auto build_wide(rugui::Node *parent, int rows, int cols, int &count) -> void {
+  for (auto r = 0; r < rows; ++r) {
+    auto row = (new rugui::Node{"row"})
+                 ->set_width(rugui::Size::Parent(1))
+                 ->set_height(rugui::Size::FitContent())
+                 ->set_flex_dir(rugui::FlexDir::Row)
+                 ->set_flex_wrap(rugui::FlexWrap::Wrap);
+    parent->add(row);
+    ++count;
+    for (auto c = 0; c < cols; ++c) {
+      row->add(make_cell(count++));
+    }
+  }
+}
+
+// Invalidate the whole tree.
+auto mark_all_dirty(rugui::Node *root) -> void {
+  root->dfs([](rugui::Node *node) -> rugui::Node::Traverse {
+    node->is_layout_dirty = true;
+    return rugui::Node::Traverse::Continue;
+  });
+}
+
+// Invalidate a single leaf, the rest of the tree is stable.
+auto mark_leaf_dirty(rugui::Node *root) -> void {
+  auto node = root;
+  while (!node->children.empty()) {
+    node = node->children.back();
+  }
+  node->mark_layout_dirty();
+}
+
+auto run(const char *name, int frames, const std::function<void(rugui::Node *, int &)> &build,
+         void (*invalidate)(rugui::Node *)) -> void {
+  auto tree = rugui::Tree{};
+  auto screen = rugui::Screen{1280, 720};
+  tree.init(&screen);
+
+  auto count = 1;
+  build(tree.root, count);
+
+  auto text_measurer = rugui::StubTextMeasurer{};
+  tree.root->layout(&text_measurer);
+
+  auto counter = CacheMissCounter{};
+  auto times = std::vector<double>{};
+  auto cache_misses = std::int64_t{};
+  for (auto frame = 0; frame < frames; ++frame) {
+    invalidate(tree.root);
+
+    counter.start();
+    const auto begin = std::chrono::steady_clock::now();
+    tree.root->layout(&text_measurer);
+    const auto end = std::chrono::steady_clock::now();
+    const auto misses = counter.stop();
+
+    times.push_back(std::chrono::duration<double, std::micro>(end - begin).count());
+    cache_misses = misses < 0 ? -1 : cache_misses + misses;
+  }
+
+  std::ranges::sort(times);
+  const auto median = times[times.size() / 2];
+  std::printf("%-7s nodes %7d | median %9.1f us/frame | %6.1f ns/node", name, count, median,
+              median * 1000.0 / count);
+  if (cache_misses >= 0) {
+    std::printf(" | %9lld cache misses/frame", (long long)(cache_misses / frames));
+  }
+  std::printf("\n");
+}
+
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+  const auto frames = argc > 1 ? std::max(std::atoi(argv[1]), 1) : 50;
+
+  const auto deep = [](rugui::Node *root, int &count) { build_deep(root, 13, count); };
+  const auto wide = [](rugui::Node *root, int &count) { build_wide(root, 100, 100, count); };
+
+  run("deep", frames, deep, mark_all_dirty);
+  run("wide", frames, wide, mark_all_dirty);
+  run("deep-1", frames, deep, mark_leaf_dirty);
+  run("wide-1", frames, wide, mark_leaf_dirty);
+
+  return EXIT_SUCCESS;
+}
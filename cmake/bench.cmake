@@ -0,0 +1,26 @@
+add_executable(rubus-gui-bench "")
+
+set_property(TARGET rubus-gui-bench PROPERTY EXCLUDE_FROM_ALL true)
+set_property(TARGET rubus-gui-bench PROPERTY CXX_STANDARD 20)
+set_property(TARGET rubus-gui-bench PROPERTY MSVC_RUNTIME_LIBRARY MultiThreaded$<$<CONFIG:Debug>:Debug>)
+use_sanitizer(rubus-gui-bench)
+skia_copy_icudtl_dat(rubus-gui-bench)
+
+target_sources(
+  rubus-gui-bench
+  PRIVATE
+    bench/layout_bench.cpp
+)
+
+target_compile_options(
+  rubus-gui-bench
+  PRIVATE
+    -Wall
+    -Wextra
+)
+
+target_link_libraries(
+  rubus-gui-bench
+  PRIVATE
+    rubus-gui
+)
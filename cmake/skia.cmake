@@ -24,6 +24,16 @@ target_link_libraries(
     ${SKIA_LIB_DIR}/skparagraph.lib
 )
 
+# system fonts (see `make_system_font_mgr`)
+if (UNIX AND NOT APPLE)
+  target_link_libraries(
+    skia
+    INTERFACE
+      fontconfig
+      freetype
+  )
+endif()
+
 function(skia_copy_icudtl_dat target)
   message(${SKIA_LIB_DIR})
   add_custom_command(
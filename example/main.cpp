@@ -38,6 +38,9 @@ auto main() -> int {
   glfwSwapInterval(1);
   gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
 
+  ui_renderer.warm_up_texts = {
+    {.text = "Hello, 세상!", .font_size = 30, .color = SkColors::kBlue, .is_grid = false},
+  };
   ui_renderer.init(&ui_screen);
   ui_tree.init(&ui_screen);
 
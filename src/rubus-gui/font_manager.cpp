@@ -0,0 +1,469 @@
+#include "font_manager.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <fstream>
+#include <map>
+#include <string_view>
+#include <tuple>
+
+#if defined(_WIN32)
+#include <include/ports/SkTypeface_win.h>
+#elif defined(__APPLE__)
+#include <include/ports/SkFontMgr_mac_ct.h>
+#else
+#include <include/ports/SkFontMgr_fontconfig.h>
+#include <include/ports/SkFontScanner_FreeType.h>
+#endif
+
+namespace rugui {
+
+auto FontFace::may_have(SkUnichar character) const -> bool {
+  if (coverage.empty()) {
+    return true;
+  }
+  const auto range = std::ranges::lower_bound(coverage, character, {}, &CharRange::last);
+  return range != coverage.end() && range->first <= character;
+}
+
+// Characters of the cmap table of the typeface, read when it is indexed. (empty if it has no unicode cmap)
+// NOTE: A format 4 segment is taken as a whole, even if some of its characters map to no glyph.
+static auto read_coverage(const SkTypeface &typeface) -> std::vector<CharRange> {
+  auto coverage = std::vector<CharRange>{};
+  const auto cmap = typeface.copyTableData(SkSetFourByteTag('c', 'm', 'a', 'p'));
+  if (cmap == nullptr) {
+    return coverage;
+  }
+
+  // (big endian, out of range reads are 0)
+  const auto bytes = std::span{(const std::uint8_t *)cmap->data(), cmap->size()};
+  const auto u16 = [&](std::size_t offset) -> std::uint32_t {
+    return offset + 2 <= bytes.size() ? (std::uint32_t)(bytes[offset] << 8 | bytes[offset + 1]) : 0;
+  };
+  const auto u32 = [&](std::size_t offset) -> std::uint32_t { return u16(offset) << 16 | u16(offset + 2); };
+
+  // - A format 12 subtable has every character, a format 4 subtable only has the basic multilingual plane.
+  // - Only unicode subtables are read. (platform 0, or windows with encoding 1 or 10)
+  auto format4 = std::size_t{};
+  auto format12 = std::size_t{};
+  const auto table_count = u16(2);
+  for (auto i = std::size_t{}; i < table_count; ++i) {
+    const auto record = 4 + i * 8;
+    const auto platform = u16(record);
+    const auto encoding = u16(record + 2);
+    const auto offset = (std::size_t)u32(record + 4);
+    if (platform != 0 && !(platform == 3 && (encoding == 1 || encoding == 10))) {
+      continue;
+    }
+    switch (u16(offset)) {
+    case 4:
+      format4 = format4 != 0 ? format4 : offset;
+      break;
+    case 12:
+      format12 = format12 != 0 ? format12 : offset;
+      break;
+    }
+  }
+
+  if (format12 != 0) {
+    const auto group_count = std::min<std::size_t>(u32(format12 + 12), (bytes.size() - format12) / 12);
+    for (auto i = std::size_t{}; i < group_count; ++i) {
+      const auto group = format12 + 16 + i * 12;
+      const auto first = u32(group);
+      const auto last = u32(group + 4);
+      if (first <= last && last <= 0x10ffff) {
+        coverage.push_back({(SkUnichar)first, (SkUnichar)last});
+      }
+    }
+  } else if (format4 != 0) {
+    const auto segment_count = (std::size_t)u16(format4 + 6) / 2;
+    for (auto i = std::size_t{}; i < segment_count; ++i) {
+      const auto last = u16(format4 + 14 + i * 2);
+      const auto first = u16(format4 + 16 + (segment_count + i) * 2);
+      // (the last segment only maps 0xffff to no glyph)
+      if (first <= last && first != 0xffff) {
+        coverage.push_back({(SkUnichar)first, (SkUnichar)last});
+      }
+    }
+  }
+
+  // sorted and merged, so a character is found by a binary search
+  std::ranges::sort(coverage, {}, &CharRange::first);
+  auto merged = std::vector<CharRange>{};
+  for (const auto &range : coverage) {
+    if (!merged.empty() && range.first <= merged.back().last + 1) {
+      merged.back().last = std::max(merged.back().last, range.last);
+    } else {
+      merged.push_back(range);
+    }
+  }
+  return merged;
+}
+
+// Faces of one family, loaded when a style is picked.
+struct LazyFontMgr::StyleSet : SkFontStyleSet {
+  sk_sp<const LazyFontMgr> font_mgr;
+  const Family *family = nullptr;
+
+  StyleSet(sk_sp<const LazyFontMgr> font_mgr, const Family *family) : font_mgr{std::move(font_mgr)}, family{family} {}
+
+  auto count() -> int override {
+    return (int)family->faces.size();
+  }
+
+  auto getStyle(int index, SkFontStyle *style, SkString *name) -> void override {
+    if (style != nullptr) {
+      *style = font_mgr->faces[family->faces[(std::size_t)index]].style;
+    }
+    if (name != nullptr) {
+      name->reset();
+    }
+  }
+
+  auto createTypeface(int index) -> sk_sp<SkTypeface> override {
+    return font_mgr->load(family->faces[(std::size_t)index]);
+  }
+
+  auto matchStyle(const SkFontStyle &pattern) -> sk_sp<SkTypeface> override {
+    // (only the matched face is loaded)
+    return matchStyleCSS3(pattern);
+  }
+};
+
+LazyFontMgr::LazyFontMgr(sk_sp<SkFontMgr> loader, std::vector<FontFace> faces)
+    : loader{std::move(loader)}, faces{std::move(faces)}, typefaces(this->faces.size()) {
+  for (auto i = std::size_t{}; i < this->faces.size(); ++i) {
+    const auto &family_name = this->faces[i].family;
+    if (family_name.empty()) {
+      continue;
+    }
+    auto family = std::ranges::find(families, family_name, &Family::name);
+    if (family == families.end()) {
+      family = families.insert(families.end(), Family{});
+      family->name = family_name;
+    }
+    family->faces.push_back(i);
+  }
+}
+
+auto LazyFontMgr::get_loaded_count() const -> std::size_t {
+  auto lock = std::scoped_lock{mutex};
+  return (std::size_t)std::ranges::count_if(typefaces, [](const auto &typeface) { return typeface != nullptr; });
+}
+
+auto LazyFontMgr::find_family(const char *name) const -> const Family * {
+  if (name == nullptr) {
+    return nullptr;
+  }
+
+  // family names are case insensitive
+  const auto is_same = [name = std::string_view{name}](const Family &family) {
+    return std::ranges::equal(family.name, name, [](char a, char b) {
+      return std::tolower((unsigned char)a) == std::tolower((unsigned char)b);
+    });
+  };
+  const auto family = std::ranges::find_if(families, is_same);
+  return family != families.end() ? &*family : nullptr;
+}
+
+auto LazyFontMgr::load(std::size_t face) const -> sk_sp<SkTypeface> {
+  auto lock = std::scoped_lock{mutex};
+  auto &typeface = typefaces[face];
+  if (typeface == nullptr) {
+    const auto &font_face = faces[face];
+    typeface = font_face.data != nullptr ? loader->makeFromData(font_face.data, font_face.ttc_index)
+                                         : loader->makeFromFile(font_face.path.c_str(), font_face.ttc_index);
+  }
+  return typeface;
+}
+
+auto LazyFontMgr::match(const Family &family, const SkFontStyle &style) const -> sk_sp<SkTypeface> {
+  return StyleSet{sk_ref_sp(this), &family}.matchStyle(style);
+}
+
+auto LazyFontMgr::onCountFamilies() const -> int {
+  return (int)families.size();
+}
+
+auto LazyFontMgr::onGetFamilyName(int index, SkString *family_name) const -> void {
+  family_name->set(families[(std::size_t)index].name.c_str());
+}
+
+auto LazyFontMgr::onCreateStyleSet(int index) const -> sk_sp<SkFontStyleSet> {
+  return sk_make_sp<StyleSet>(sk_ref_sp(this), &families[(std::size_t)index]);
+}
+
+auto LazyFontMgr::onMatchFamily(const char family_name[]) const -> sk_sp<SkFontStyleSet> {
+  const auto family = find_family(family_name);
+  return family != nullptr ? sk_make_sp<StyleSet>(sk_ref_sp(this), family) : nullptr;
+}
+
+auto LazyFontMgr::onMatchFamilyStyle(const char family_name[], const SkFontStyle &style) const
+  -> sk_sp<SkTypeface> {
+  const auto family = family_name == nullptr && !families.empty() ? &families.front() : find_family(family_name);
+  return family != nullptr ? match(*family, style) : nullptr;
+}
+
+auto LazyFontMgr::onMatchFamilyStyleCharacter(const char family_name[], const SkFontStyle &style, const char *[],
+                                              int, SkUnichar character) const -> sk_sp<SkTypeface> {
+  // - The requested family first, then the families with a face that has the character in its coverage.
+  // - Only the families that may have it are loaded. (the coverage is saved in the index)
+  const auto may_have = [&](const Family &family) {
+    return std::ranges::any_of(family.faces, [&](std::size_t face) { return faces[face].may_have(character); });
+  };
+  const auto requested = find_family(family_name);
+  if (requested != nullptr && may_have(*requested)) {
+    if (auto typeface = match(*requested, style); typeface != nullptr && typeface->unicharToGlyph(character) != 0) {
+      return typeface;
+    }
+  }
+  for (const auto &family : families) {
+    if (&family == requested || !may_have(family)) {
+      continue;
+    }
+    if (auto typeface = match(family, style); typeface != nullptr && typeface->unicharToGlyph(character) != 0) {
+      return typeface;
+    }
+  }
+  return nullptr;
+}
+
+auto LazyFontMgr::onMakeFromData(sk_sp<SkData> data, int ttc_index) const -> sk_sp<SkTypeface> {
+  return loader->makeFromData(std::move(data), ttc_index);
+}
+
+auto LazyFontMgr::onMakeFromStreamIndex(std::unique_ptr<SkStreamAsset> stream, int ttc_index) const
+  -> sk_sp<SkTypeface> {
+  return loader->makeFromStream(std::move(stream), ttc_index);
+}
+
+auto LazyFontMgr::onMakeFromStreamArgs(std::unique_ptr<SkStreamAsset> stream, const SkFontArguments &args) const
+  -> sk_sp<SkTypeface> {
+  return loader->makeFromStream(std::move(stream), args);
+}
+
+auto LazyFontMgr::onMakeFromFile(const char path[], int ttc_index) const -> sk_sp<SkTypeface> {
+  return loader->makeFromFile(path, ttc_index);
+}
+
+auto LazyFontMgr::onLegacyMakeTypeface(const char family_name[], SkFontStyle style) const -> sk_sp<SkTypeface> {
+  // unknown families fall back to the default family
+  if (auto typeface = onMatchFamilyStyle(family_name, style); typeface != nullptr) {
+    return typeface;
+  }
+  return families.empty() ? nullptr : match(families.front(), style);
+}
+
+// NOTE: Bump the version when the format changes, an index of another version is ignored.
+constexpr auto font_index_header = std::string_view{"rubus-gui font index 2"};
+
+auto load_font_index(const std::filesystem::path &path) -> std::vector<FontFace> {
+  auto faces = std::vector<FontFace>{};
+  auto file = std::ifstream{path, std::ios::binary};
+  auto line = std::string{};
+  if (!std::getline(file, line) || line != font_index_header) {
+    return faces;
+  }
+
+  // - One face per line: path, ttc index, file time, file size, weight, width, slant, coverage, family.
+  //   (separated by tabs)
+  // - Coverage is a list of hex ranges like `20-7e,a0-17f`. (empty if unknown)
+  while (std::getline(file, line)) {
+    auto fields = std::array<std::string_view, 9>{};
+    auto rest = std::string_view{line};
+    auto field_count = std::size_t{};
+    for (; field_count < fields.size() && !rest.empty(); ++field_count) {
+      const auto end = field_count + 1 < fields.size() ? rest.find('\t') : std::string_view::npos;
+      fields[field_count] = rest.substr(0, end);
+      rest = end == std::string_view::npos ? std::string_view{} : rest.substr(end + 1);
+    }
+    if (field_count < fields.size() - 1) {
+      continue;
+    }
+
+    auto face = FontFace{};
+    face.family = fields[8];
+    face.path = fields[0];
+    auto weight = 0;
+    auto width = 0;
+    auto slant = 0;
+    const auto parse = [](std::string_view field, auto &value) {
+      const auto result = std::from_chars(field.data(), field.data() + field.size(), value);
+      return result.ec == std::errc{} && result.ptr == field.data() + field.size();
+    };
+    const auto parse_hex = [](std::string_view field, SkUnichar &value) {
+      const auto result = std::from_chars(field.data(), field.data() + field.size(), value, 16);
+      return result.ec == std::errc{} && result.ptr == field.data() + field.size();
+    };
+    if (!parse(fields[1], face.ttc_index) || !parse(fields[2], face.file_time) || !parse(fields[3], face.file_size) ||
+        !parse(fields[4], weight) || !parse(fields[5], width) || !parse(fields[6], slant)) {
+      continue;
+    }
+    face.style = SkFontStyle{weight, width, (SkFontStyle::Slant)slant};
+
+    auto is_coverage_valid = true;
+    for (auto ranges = fields[7]; !ranges.empty() && is_coverage_valid;) {
+      const auto end = ranges.find(',');
+      const auto range = ranges.substr(0, end);
+      ranges = end == std::string_view::npos ? std::string_view{} : ranges.substr(end + 1);
+
+      const auto dash = range.find('-');
+      auto &char_range = face.coverage.emplace_back();
+      is_coverage_valid = dash != std::string_view::npos && parse_hex(range.substr(0, dash), char_range.first) &&
+                          parse_hex(range.substr(dash + 1), char_range.last);
+    }
+    if (!is_coverage_valid) {
+      face.coverage.clear();
+    }
+    faces.push_back(std::move(face));
+  }
+  return faces;
+}
+
+auto save_font_index(const std::filesystem::path &path, std::span<const FontFace> faces) -> bool {
+  auto file = std::ofstream{path, std::ios::binary | std::ios::trunc};
+  file << font_index_header << '\n';
+  for (const auto &face : faces) {
+    if (face.path.empty()) {
+      continue;
+    }
+    file << face.path << '\t' << face.ttc_index << '\t' << face.file_time << '\t' << face.file_size << '\t'
+         << face.style.weight() << '\t' << face.style.width() << '\t' << (int)face.style.slant() << '\t';
+    for (auto i = std::size_t{}; i < face.coverage.size(); ++i) {
+      file << (i != 0 ? "," : "") << std::hex << face.coverage[i].first << '-' << face.coverage[i].last << std::dec;
+    }
+    file << '\t' << face.family << '\n';
+  }
+  return (bool)file;
+}
+
+auto index_font_directory(const sk_sp<SkFontMgr> &loader, const std::filesystem::path &directory,
+                          const std::filesystem::path &index_path) -> std::vector<FontFace> {
+  auto saved = std::map<std::string, std::vector<FontFace>>{};
+  auto saved_count = std::size_t{};
+  if (!index_path.empty()) {
+    for (auto &face : load_font_index(index_path)) {
+      saved[face.path].push_back(std::move(face));
+      ++saved_count;
+    }
+  }
+
+  // - Only the files that are not in the index or changed since are opened.
+  // - A font collection has a face per index, the other files only have the first.
+  auto faces = std::vector<FontFace>{};
+  auto reused_count = std::size_t{};
+  auto error = std::error_code{};
+  for (auto it = std::filesystem::recursive_directory_iterator{
+         directory, std::filesystem::directory_options::skip_permission_denied, error};
+       !error && it != std::filesystem::recursive_directory_iterator{}; it.increment(error)) {
+    auto file_error = std::error_code{};
+    if (!it->is_regular_file(file_error)) {
+      continue;
+    }
+    auto extension = it->path().extension().string();
+    std::ranges::transform(extension, extension.begin(), [](char c) { return (char)std::tolower((unsigned char)c); });
+    if (extension != ".ttf" && extension != ".otf" && extension != ".ttc" && extension != ".otc") {
+      continue;
+    }
+
+    const auto path = it->path().string();
+    const auto file_time = (std::int64_t)it->last_write_time(file_error).time_since_epoch().count();
+    const auto file_size = it->file_size(file_error);
+    if (file_error) {
+      continue;
+    }
+
+    if (const auto found = saved.find(path); found != saved.end() && found->second.front().file_time == file_time &&
+                                             found->second.front().file_size == file_size) {
+      faces.insert(faces.end(), found->second.begin(), found->second.end());
+      reused_count += found->second.size();
+      continue;
+    }
+
+    const auto is_collection = extension == ".ttc" || extension == ".otc";
+    const auto first_face = faces.size();
+    for (auto ttc_index = 0; ttc_index == 0 || is_collection; ++ttc_index) {
+      const auto typeface = loader->makeFromFile(path.c_str(), ttc_index);
+      if (typeface == nullptr) {
+        break;
+      }
+      auto family_name = SkString{};
+      typeface->getFamilyName(&family_name);
+      auto &face = faces.emplace_back();
+      face.family = family_name.c_str();
+      face.style = typeface->fontStyle();
+      face.ttc_index = ttc_index;
+      face.coverage = read_coverage(*typeface);
+    }
+    if (faces.size() == first_face) {
+      faces.emplace_back();
+    }
+    for (auto i = first_face; i < faces.size(); ++i) {
+      faces[i].path = path;
+      faces[i].file_time = file_time;
+      faces[i].file_size = file_size;
+    }
+  }
+
+  // (the directory is not listed in a fixed order)
+  std::ranges::sort(faces, {}, [](const FontFace &face) { return std::tie(face.path, face.ttc_index); });
+
+  if (!index_path.empty() && (reused_count != saved_count || faces.size() != saved_count)) {
+    save_font_index(index_path, faces);
+  }
+  return faces;
+}
+
+auto index_font_data(const sk_sp<SkFontMgr> &loader, std::span<const sk_sp<SkData>> data) -> std::vector<FontFace> {
+  // NOTE: The data is already in memory, the faces are opened once to read their names.
+  auto faces = std::vector<FontFace>{};
+  for (const auto &font_data : data) {
+    for (auto ttc_index = 0;; ++ttc_index) {
+      const auto typeface = loader->makeFromData(font_data, ttc_index);
+      if (typeface == nullptr) {
+        break;
+      }
+      auto family_name = SkString{};
+      typeface->getFamilyName(&family_name);
+      auto &face = faces.emplace_back();
+      face.family = family_name.c_str();
+      face.style = typeface->fontStyle();
+      face.data = font_data;
+      face.ttc_index = ttc_index;
+      face.coverage = read_coverage(*typeface);
+    }
+  }
+  return faces;
+}
+
+auto make_system_font_mgr() -> sk_sp<SkFontMgr> {
+#if defined(_WIN32)
+  return SkFontMgr_New_DirectWrite();
+#elif defined(__APPLE__)
+  return SkFontMgr_New_CoreText(nullptr);
+#else
+  // fontconfig keeps its own cache of the installed fonts
+  return SkFontMgr_New_FontConfig(nullptr, SkFontScanner_Make_FreeType());
+#endif
+}
+
+auto make_font_mgr(const FontOptions &options) -> sk_sp<SkFontMgr> {
+  auto system_font_mgr = make_system_font_mgr();
+  switch (options.source) {
+  case FontSource::System:
+    return system_font_mgr;
+  case FontSource::Directory: {
+    auto faces = index_font_directory(system_font_mgr, options.directory, options.index_path);
+    return sk_make_sp<LazyFontMgr>(system_font_mgr, std::move(faces));
+  }
+  case FontSource::Embedded: {
+    auto faces = index_font_data(system_font_mgr, options.embedded);
+    return sk_make_sp<LazyFontMgr>(system_font_mgr, std::move(faces));
+  }
+  }
+  return system_font_mgr;
+}
+
+} // namespace rugui
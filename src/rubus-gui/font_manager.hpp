@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <include/core/SkData.h>
+#include <include/core/SkFontMgr.h>
+#include <include/core/SkFontStyle.h>
+#include <include/core/SkStream.h>
+#include <include/core/SkTypeface.h>
+
+namespace rugui {
+
+enum class FontSource {
+  System,    // Fonts installed on the system. (default)
+  Directory, // Font files under `FontOptions::directory`.
+  Embedded,  // Font data in `FontOptions::embedded`.
+};
+
+// Where the renderer finds its fonts. (see `make_font_mgr`)
+struct FontOptions {
+  FontSource source = FontSource::System;
+  std::filesystem::path directory;
+  std::filesystem::path index_path; // Faces of `directory` saved for the next launch. (not saved if empty)
+  std::vector<sk_sp<SkData>> embedded;
+};
+
+// Characters from `first` to `last`. (inclusive)
+struct CharRange {
+  SkUnichar first = 0;
+  SkUnichar last = 0;
+};
+
+// A face of a font file or font data, known by its family and style until it is loaded.
+struct FontFace {
+  std::string family; // (empty for a file without faces, so it is not opened again)
+  SkFontStyle style;
+  std::string path;   // (empty for font data)
+  sk_sp<SkData> data;
+  int ttc_index = 0;  // Index of the face in a font collection.
+  std::int64_t file_time = 0;   // Last write time of the file when it was indexed.
+  std::uintmax_t file_size = 0; // Size of the file when it was indexed.
+  std::vector<CharRange> coverage; // Characters of the cmap table, in order. (empty if unknown)
+
+  // NOTE: A face with unknown coverage may have any character, it is loaded to find out.
+  auto may_have(SkUnichar character) const -> bool;
+};
+
+// Font manager over a fixed list of faces, a face is only loaded the first time it is matched.
+// NOTE: Shared by the font collections of every layout worker, so it is thread safe.
+struct LazyFontMgr : SkFontMgr {
+private:
+  struct Family {
+    std::string name;
+    std::vector<std::size_t> faces; // (indices in `faces`)
+  };
+  struct StyleSet;
+
+  sk_sp<SkFontMgr> loader; // Opens the faces. (the font manager of the system)
+  std::vector<FontFace> faces;
+  std::vector<Family> families; // (the family of the first face is the default)
+
+  mutable std::mutex mutex;
+  mutable std::vector<sk_sp<SkTypeface>> typefaces; // (null until loaded, indexed like `faces`)
+
+public:
+  LazyFontMgr(sk_sp<SkFontMgr> loader, std::vector<FontFace> faces);
+
+  auto get_loaded_count() const -> std::size_t;
+
+private:
+  auto find_family(const char *name) const -> const Family *;
+  auto load(std::size_t face) const -> sk_sp<SkTypeface>;
+  auto match(const Family &family, const SkFontStyle &style) const -> sk_sp<SkTypeface>;
+
+protected:
+  auto onCountFamilies() const -> int override;
+  auto onGetFamilyName(int index, SkString *family_name) const -> void override;
+  auto onCreateStyleSet(int index) const -> sk_sp<SkFontStyleSet> override;
+  auto onMatchFamily(const char family_name[]) const -> sk_sp<SkFontStyleSet> override;
+  auto onMatchFamilyStyle(const char family_name[], const SkFontStyle &style) const -> sk_sp<SkTypeface> override;
+  auto onMatchFamilyStyleCharacter(const char family_name[], const SkFontStyle &style, const char *bcp47[],
+                                   int bcp47_count, SkUnichar character) const -> sk_sp<SkTypeface> override;
+  auto onMakeFromData(sk_sp<SkData> data, int ttc_index) const -> sk_sp<SkTypeface> override;
+  auto onMakeFromStreamIndex(std::unique_ptr<SkStreamAsset> stream, int ttc_index) const
+    -> sk_sp<SkTypeface> override;
+  auto onMakeFromStreamArgs(std::unique_ptr<SkStreamAsset> stream, const SkFontArguments &args) const
+    -> sk_sp<SkTypeface> override;
+  auto onMakeFromFile(const char path[], int ttc_index) const -> sk_sp<SkTypeface> override;
+  auto onLegacyMakeTypeface(const char family_name[], SkFontStyle style) const -> sk_sp<SkTypeface> override;
+};
+
+auto load_font_index(const std::filesystem::path &path) -> std::vector<FontFace>;
+auto save_font_index(const std::filesystem::path &path, std::span<const FontFace> faces) -> bool;
+
+// Faces of the font files under the directory. (files unchanged since they were saved in `index_path` are not opened)
+auto index_font_directory(const sk_sp<SkFontMgr> &loader, const std::filesystem::path &directory,
+                          const std::filesystem::path &index_path) -> std::vector<FontFace>;
+auto index_font_data(const sk_sp<SkFontMgr> &loader, std::span<const sk_sp<SkData>> data) -> std::vector<FontFace>;
+
+// DirectWrite on windows, CoreText on macos and fontconfig elsewhere. (fonts are only opened when matched)
+auto make_system_font_mgr() -> sk_sp<SkFontMgr>;
+auto make_font_mgr(const FontOptions &options) -> sk_sp<SkFontMgr>;
+
+} // namespace rugui
@@ -0,0 +1,592 @@
+#include "layout_store.hpp"
+#include "node.hpp"
+#include "simd.hpp"
+
+#include <ranges>
+#include <algorithm>
+
+namespace rugui {
+
+auto LayoutStore::allocate(Node *node) -> NodeId {
+  auto id = NodeId{};
+  if (!free_ids.empty()) {
+    id = free_ids.back();
+    free_ids.pop_back();
+    nodes[id] = node;
+    layout_cache[id] = {};
+  } else {
+    id = (NodeId)nodes.size();
+    nodes.push_back(node);
+    computed.emplace_back();
+    pos.emplace_back();
+    local_pos.emplace_back();
+    rect_size.emplace_back();
+    layout_size.emplace_back();
+    content_size.emplace_back();
+    content_overflow.emplace_back();
+    max_content_area.emplace_back();
+    children_origin.emplace_back();
+    flex_lines.emplace_back();
+    text_layout_width.emplace_back();
+    layout_cache.emplace_back();
+    screen_transform.emplace_back(SkMatrix::I());
+    clip_rect.emplace_back(SkRect::MakeEmpty());
+    pre_order_index.emplace_back();
+    level_order_index.emplace_back();
+    is_skipped.emplace_back();
+  }
+  reset(id);
+  if (node->type == Node::Type::List) {
+    list_nodes.push_back(node);
+  }
+  if (node->lazy_drop_delay) {
+    lazy_nodes.push_back(node);
+  }
+  if (node->type == Node::Type::Text && node->text_data->is_paragraph_dirty) {
+    node->text_data->is_shape_queued = true;
+    shape_queue.push_back(node);
+  }
+  is_order_dirty = true;
+  return id;
+}
+
+auto LayoutStore::release(NodeId id) -> void {
+  if (on_release) {
+    on_release(nodes[id]);
+  }
+  if (nodes[id]->type == Node::Type::List) {
+    std::erase(list_nodes, nodes[id]);
+  }
+  if (nodes[id]->lazy_drop_delay) {
+    std::erase(lazy_nodes, nodes[id]);
+  }
+  if (nodes[id]->type == Node::Type::Text && nodes[id]->text_data->is_shape_queued) {
+    nodes[id]->text_data->is_shape_queued = false;
+    std::erase(shape_queue, nodes[id]);
+  }
+  if (nodes[id]->type == Node::Type::Text && nodes[id]->text_data->is_resize_queued) {
+    nodes[id]->text_data->is_resize_queued = false;
+    std::erase(resized_text, nodes[id]);
+  }
+  nodes[id] = nullptr;
+  free_ids.push_back(id);
+  is_order_dirty = true;
+}
+
+auto LayoutStore::reset(NodeId id) -> void {
+  pos[id] = {0, 0};
+  local_pos[id] = {0, 0};
+  rect_size[id] = {0, 0};
+  layout_size[id] = {0, 0};
+  content_size[id] = {0, 0};
+  content_overflow[id] = {0, 0};
+  max_content_area[id] = {0, 0};
+  children_origin[id] = {0, 0};
+  flex_lines[id].clear();
+}
+
+auto LayoutStore::update_order(Node *node) -> void {
+  if (!is_order_dirty) {
+    return;
+  }
+  is_order_dirty = false;
+
+  // the sliced layout in progress was laid out in the old order
+  cancel_sliced_layout();
+
+  auto root = node;
+  while (root->parent != nullptr) {
+    root = root->parent;
+  }
+
+  pre_order.clear();
+  pre_order_end.clear();
+  pre_order_depth.clear();
+  level_order.clear();
+  level_order_depth.clear();
+
+  // level order (children of a node are contiguous)
+  level_order.push_back(root);
+  level_order_depth.push_back(0);
+  for (auto i = std::size_t{}; i < level_order.size(); ++i) {
+    level_order_index[level_order[i]->id] = (std::uint32_t)i;
+    for (const auto child : level_order[i]->children) {
+      level_order.push_back(child);
+      level_order_depth.push_back(level_order_depth[i] + 1);
+    }
+  }
+
+  // pre order
+  auto stack = std::vector<Node *>{root};
+  while (!stack.empty()) {
+    const auto node = stack.back();
+    stack.pop_back();
+    const auto depth = node == root ? 0 : pre_order_depth[pre_order_index[node->parent->id]] + 1;
+    pre_order_index[node->id] = (std::uint32_t)pre_order.size();
+    pre_order.push_back(node);
+    pre_order_end.push_back(0);
+    pre_order_depth.push_back(depth);
+    for (const auto child : node->children | std::ranges::views::reverse) {
+      stack.push_back(child);
+    }
+  }
+
+  // a subtree ends where the next node that is not deeper than its root begins
+  auto open = std::vector<std::uint32_t>{};
+  for (auto i = std::uint32_t{}; i < pre_order.size(); ++i) {
+    while (!open.empty() && pre_order_depth[open.back()] >= pre_order_depth[i]) {
+      pre_order_end[open.back()] = i;
+      open.pop_back();
+    }
+    open.push_back(i);
+  }
+  for (const auto i : open) {
+    pre_order_end[i] = (std::uint32_t)pre_order.size();
+  }
+}
+
+auto LayoutStore::apply_text_block_sizes() -> void {
+  // the blocks painted since the last layout were shaped, their shaped sizes replace the estimates
+  for (const auto node : resized_text) {
+    auto &text_data = *node->text_data;
+    text_data.is_resize_queued = false;
+    if (text_data.blocks == nullptr) {
+      continue;
+    }
+    for (auto &block : text_data.blocks->blocks) {
+      if (block.shaped != nullptr && block.is_estimated) {
+        block.is_estimated = false;
+        block.memo.clear();
+      }
+    }
+    text_data.paragraph_memo.clear();
+    node->mark_layout_dirty();
+  }
+  resized_text.clear();
+}
+
+auto LayoutStore::drop_lazy_children() -> void {
+  if (lazy_nodes.empty()) {
+    return;
+  }
+
+  // drop the children of lazy nodes that stayed collapsed
+  const auto now = std::chrono::steady_clock::now();
+  auto is_dropped = true;
+  while (is_dropped) {
+    // stops right after a drop, which may have changed `lazy_nodes`
+    is_dropped = std::ranges::any_of(lazy_nodes, [&](Node *node) { return node->drop_lazy_children(now); });
+  }
+}
+
+auto LayoutStore::update_list_rows() -> bool {
+  // the rows of a list depend on its scroll and viewport
+  auto is_changed = false;
+  for (const auto node : list_nodes) {
+    is_changed |= node->update_list_rows();
+  }
+  return is_changed;
+}
+
+auto LayoutStore::shape_dirty_text(TextMeasurer *text_measurer, ThreadPool *thread_pool) -> void {
+  if (shape_queue.empty()) {
+    return;
+  }
+
+  // shape the changed text up front, so the measure sweep does not shape one node at a time
+  auto nodes = std::vector<Node *>{};
+  for (const auto node : shape_queue) {
+    node->text_data->is_shape_queued = false;
+    if (!node->text_data->is_paragraph_dirty) {
+      continue;
+    }
+
+    // the text inside a collapsed node is shaped when it is shown
+    auto is_collapsed = false;
+    for (auto ancestor = node; ancestor != nullptr && !is_collapsed; ancestor = ancestor->parent) {
+      is_collapsed = ancestor->display_mode == DisplayMode::Collapsed;
+    }
+    if (!is_collapsed) {
+      nodes.push_back(node);
+    }
+  }
+  shape_queue.clear();
+
+  text_measurer->shape_all(nodes, thread_pool);
+}
+
+auto LayoutStore::copy_layout(LayoutBuffer &buffer) -> void {
+  // NOTE: Assigning over the old buffer reuses the memory of `flex_lines`.
+  buffer.computed = computed;
+  buffer.pos = pos;
+  buffer.local_pos = local_pos;
+  buffer.rect_size = rect_size;
+  buffer.layout_size = layout_size;
+  buffer.content_size = content_size;
+  buffer.content_overflow = content_overflow;
+  buffer.max_content_area = max_content_area;
+  buffer.children_origin = children_origin;
+  buffer.flex_lines = flex_lines;
+  buffer.text_layout_width = text_layout_width;
+  buffer.layout_cache = layout_cache;
+}
+
+auto LayoutStore::swap_layout(LayoutBuffer &buffer) -> void {
+  std::swap(buffer.computed, computed);
+  std::swap(buffer.pos, pos);
+  std::swap(buffer.local_pos, local_pos);
+  std::swap(buffer.rect_size, rect_size);
+  std::swap(buffer.layout_size, layout_size);
+  std::swap(buffer.content_size, content_size);
+  std::swap(buffer.content_overflow, content_overflow);
+  std::swap(buffer.max_content_area, max_content_area);
+  std::swap(buffer.children_origin, children_origin);
+  std::swap(buffer.flex_lines, flex_lines);
+  std::swap(buffer.text_layout_width, text_layout_width);
+  std::swap(buffer.layout_cache, layout_cache);
+}
+
+auto LayoutStore::cancel_sliced_layout() -> void {
+  if (sliced_layout.phase == LayoutPhase::Idle) {
+    return;
+  }
+
+  // the output of the canceled layout is dropped, the nodes it cleaned must be laid out again
+  for (const auto id : sliced_layout.cleaned) {
+    if (nodes[id] != nullptr) {
+      nodes[id]->mark_layout_dirty();
+    }
+  }
+  sliced_layout.cleaned.clear();
+  sliced_layout.phase = LayoutPhase::Idle;
+  sliced_layout.root = nullptr;
+}
+
+auto LayoutStore::get_rect_pos(NodeId id) -> SkPoint {
+  const auto &style = nodes[id]->style;
+  return {pos[id].fX + style->margin_l, pos[id].fY + style->margin_t};
+}
+
+auto LayoutStore::get_content_area(NodeId id) -> SkSize {
+  const auto &style = nodes[id]->style;
+  return SkSize{
+    rect_size[id].fWidth - style->padding_l - style->padding_r,
+    rect_size[id].fHeight - style->padding_t - style->padding_b,
+  };
+}
+
+auto LayoutStore::get_margin_row(NodeId id) -> float {
+  const auto &style = nodes[id]->style;
+  return style->margin_l + style->margin_r;
+}
+
+auto LayoutStore::get_margin_col(NodeId id) -> float {
+  const auto &style = nodes[id]->style;
+  return style->margin_t + style->margin_b;
+}
+
+auto LayoutStore::get_padding_row(NodeId id) -> float {
+  const auto &style = nodes[id]->style;
+  return style->padding_l + style->padding_r;
+}
+
+auto LayoutStore::get_padding_col(NodeId id) -> float {
+  const auto &style = nodes[id]->style;
+  return style->padding_t + style->padding_b;
+}
+
+// Layout sizes of the children packed in child order, so they are read by simd kernels.
+// NOTE: One buffer per thread, layout workers measure different nodes at the same time.
+static auto gather_child_sizes(const std::vector<SkSize> &layout_size, Node *node) -> std::span<const SkSize> {
+  thread_local auto sizes = std::vector<SkSize>{};
+  sizes.resize(node->children.size());
+  for (auto i = std::size_t{}; i < node->children.size(); ++i) {
+    sizes[i] = layout_size[node->children[i]->id];
+  }
+  return sizes;
+}
+
+auto LayoutStore::accumulate_child_sizes(Node *node) -> ChildSizes {
+  const auto sizes = gather_child_sizes(layout_size, node);
+  auto child_sizes = ChildSizes{{0, 0}, max_sizes(sizes)};
+  for (const auto &size : sizes) {
+    child_sizes.sum.fWidth += size.fWidth;
+    child_sizes.sum.fHeight += size.fHeight;
+  }
+  return child_sizes;
+}
+
+auto LayoutStore::calculate_flex_lines(Node *node, TextMeasurer *text_measurer) -> void {
+  const auto id = node->id;
+
+  flex_lines[id].emplace_back();
+  auto &content_width = content_size[id].fWidth;
+  auto &content_height = content_size[id].fHeight;
+
+  switch (node->style->flex_wrap) {
+  case FlexWrap::NoWrap: {
+    auto &line = flex_lines[id].back();
+    switch (node->type) {
+    case Node::Type::Rect:
+    case Node::Type::List: {
+      line.first = 0;
+      line.count = (std::uint32_t)node->children.size();
+      const auto child_sizes = accumulate_child_sizes(node);
+      switch (node->style->flex_dir) {
+      case FlexDir::Row:
+        line.width = child_sizes.sum.fWidth;
+        line.height = child_sizes.max.fHeight;
+        break;
+      case FlexDir::Col:
+        line.width = child_sizes.max.fWidth;
+        line.height = child_sizes.sum.fHeight;
+        break;
+      }
+
+      content_width = line.width;
+      content_height = line.height;
+
+      if (computed[id].width.mode == SizeMode::FitContent) {
+        const auto margin_row = get_margin_row(id);
+        const auto padding_row = get_padding_row(id);
+        layout_size[id].fWidth = content_width + margin_row + padding_row;
+        rect_size[id].fWidth = content_width + padding_row;
+      }
+      if (computed[id].height.mode == SizeMode::FitContent) {
+        const auto margin_col = get_margin_col(id);
+        const auto padding_col = get_padding_col(id);
+        layout_size[id].fHeight = content_height + margin_col + padding_col;
+        rect_size[id].fHeight = content_height + padding_col;
+      }
+    } break;
+    case Node::Type::Text: {
+      const auto metrics = node->layout_paragraph(text_measurer, get_content_area(id).fWidth);
+      content_width = metrics.longest_line;
+      content_height = metrics.height;
+
+      if (computed[id].width.mode == SizeMode::FitContent) {
+        const auto margin_row = get_margin_row(id);
+        layout_size[id].fWidth = content_width + margin_row;
+        rect_size[id].fWidth = content_width;
+      }
+      if (computed[id].height.mode == SizeMode::FitContent) {
+        const auto margin_col = get_margin_col(id);
+        layout_size[id].fHeight = content_height + margin_col;
+        rect_size[id].fHeight = content_height;
+      }
+
+      line.width = layout_size[id].fWidth;
+      line.height = layout_size[id].fHeight;
+    } break;
+    case Node::Type::Grid:
+      // (no flex lines, the size is known after `Node::layout_fit_content()`)
+      break;
+    }
+  } break;
+  case FlexWrap::Wrap: {
+    switch (node->type) {
+    case Node::Type::Rect:
+    case Node::Type::List: {
+      content_width = 0.f;
+      content_height = 0.f;
+
+      const auto is_row = node->style->flex_dir == FlexDir::Row;
+      const auto content_area = get_content_area(id);
+      const auto main_area = is_row ? content_area.fWidth : content_area.fHeight;
+      const auto sizes = gather_child_sizes(layout_size, node);
+      auto line_main = 0.f; // Size of the current line along the flex direction.
+      auto line_start = std::size_t{};
+
+      const auto end_line = [&](FlexLine &line, std::size_t line_end) {
+        // (the cross size is the largest child, it does not depend on the order)
+        const auto line_max = max_sizes(sizes.subspan(line_start, line_end - line_start));
+        const auto line_width = is_row ? line_main : line_max.fWidth;
+        const auto line_height = is_row ? line_max.fHeight : line_main;
+        line.first = (std::uint32_t)line_start;
+        line.count = (std::uint32_t)(line_end - line_start);
+        line.width = line_width;
+        line.height = line_height;
+
+        if (is_row) {
+          if (content_width < line_width) {
+            content_width = line_width;
+          }
+          content_height += line_height;
+        } else {
+          content_width += line_width;
+          if (content_height < line_height) {
+            content_height = line_height;
+          }
+        }
+      };
+
+      // Find where each line overflows: the line sizes are added in child order a chunk at a time,
+      // then the chunk is searched for the first one past the content area.
+      // NOTE: The first child of a line is never checked, unless it is the first child. (it would not fit any line)
+      thread_local auto line_sums = std::vector<float>{};
+      constexpr auto chunk_size = std::size_t{64};
+      auto i = std::size_t{};
+      while (i < sizes.size()) {
+        const auto chunk_end = std::min(i + chunk_size, sizes.size());
+        line_sums.clear();
+        auto line_sum = line_main;
+        for (auto k = i; k < chunk_end; ++k) {
+          line_sum += is_row ? sizes[k].fWidth : sizes[k].fHeight;
+          line_sums.push_back(line_sum);
+        }
+
+        const auto overflow = find_greater(line_sums, main_area);
+        if (overflow == line_sums.size()) {
+          line_main = line_sum;
+          i = chunk_end;
+          continue;
+        }
+
+        // check overflow
+        if (overflow != 0) {
+          line_main = line_sums[overflow - 1];
+        }
+        end_line(flex_lines[id].back(), i + overflow);
+        line_start = i + overflow;
+        flex_lines[id].emplace_back();
+
+        line_main = 0;
+        line_main += is_row ? sizes[line_start].fWidth : sizes[line_start].fHeight;
+        i = line_start + 1;
+      }
+
+      if (!node->children.empty()) {
+        if (flex_lines[id].back().count != 0) {
+          flex_lines[id].emplace_back();
+        }
+        end_line(flex_lines[id].back(), node->children.size());
+      }
+    } break;
+    case Node::Type::Text: {
+      auto content_area_width = get_content_area(id).fWidth;
+      if (computed[node->parent->id].width.mode == SizeMode::FitContent) {
+        content_area_width = max_content_area[node->parent->id].fWidth - get_margin_row(id);
+      }
+
+      if (content_width > content_area_width) {
+        const auto metrics = node->layout_paragraph(text_measurer, content_area_width);
+        content_width = metrics.longest_line;
+        content_height = metrics.height;
+      }
+
+      if (computed[id].width.mode == SizeMode::FitContent) {
+        const auto margin_row = get_margin_row(id);
+        layout_size[id].fWidth = content_width + margin_row;
+        rect_size[id].fWidth = content_width;
+      }
+      if (computed[id].height.mode == SizeMode::FitContent) {
+        const auto margin_col = get_margin_col(id);
+        layout_size[id].fHeight = content_height + margin_col;
+        rect_size[id].fHeight = content_height;
+      }
+    } break;
+    case Node::Type::Grid:
+      break;
+    }
+  } break;
+  }
+}
+
+auto LayoutStore::begin_measure_cache(Node *node) -> void {
+  auto &cache = layout_cache[node->id];
+  cache.is_measure_valid = false;
+  cache.is_arrange_valid = false;
+  cache.parent_content_area = node->parent != nullptr ? get_content_area(node->parent->id) : SkSize{0, 0};
+}
+
+auto LayoutStore::end_measure_cache(NodeId id) -> void {
+  auto &cache = layout_cache[id];
+  cache.is_measure_valid = true;
+  cache.computed = computed[id];
+  cache.measured_layout_size = layout_size[id];
+  cache.measured_rect_size = rect_size[id];
+  cache.measured_content_size = content_size[id];
+}
+
+auto LayoutStore::find_measure_cache(Node *node, const ComputedStyle &computed) -> bool {
+  const auto &cache = layout_cache[node->id];
+  if (!cache.is_measure_valid) {
+    return false;
+  }
+  if (cache.computed.flex_align != computed.flex_align ||
+      cache.computed.flex_items_align != computed.flex_items_align ||
+      cache.computed.flex_self_align != computed.flex_self_align) {
+    return false;
+  }
+
+  // only sizes relative to the parent depend on it
+  const auto parent_content_area = get_content_area(node->parent->id);
+  if (node->style->width.mode == SizeMode::Parent &&
+      cache.parent_content_area.fWidth != parent_content_area.fWidth) {
+    return false;
+  }
+  if (node->style->height.mode == SizeMode::Parent &&
+      cache.parent_content_area.fHeight != parent_content_area.fHeight) {
+    return false;
+  }
+
+  load_measure_cache(node->id);
+  return true;
+}
+
+auto LayoutStore::load_measure_cache(NodeId id) -> void {
+  const auto &cache = layout_cache[id];
+  computed[id] = cache.computed;
+  layout_size[id] = cache.measured_layout_size;
+  rect_size[id] = cache.measured_rect_size;
+  content_size[id] = cache.measured_content_size;
+}
+
+auto LayoutStore::begin_arrange_cache(Node *node) -> void {
+  const auto id = node->id;
+  auto &cache = layout_cache[id];
+  cache.is_arrange_valid = false;
+  cache.max_content_area = max_content_area[id];
+  cache.arranged_layout_size = layout_size[id];
+  cache.arranged_rect_size = rect_size[id];
+  if (node->parent != nullptr) {
+    cache.parent_max_content_area = max_content_area[node->parent->id];
+    cache.parent_width_mode = computed[node->parent->id].width.mode;
+  }
+}
+
+auto LayoutStore::end_arrange_cache(NodeId id) -> void {
+  auto &cache = layout_cache[id];
+  cache.is_arrange_valid = true;
+  cache.layout_size = layout_size[id];
+  cache.rect_size = rect_size[id];
+  cache.content_size = content_size[id];
+  cache.content_overflow = content_overflow[id];
+}
+
+auto LayoutStore::find_arrange_cache(Node *node) -> bool {
+  const auto id = node->id;
+  const auto &cache = layout_cache[id];
+  if (!cache.is_arrange_valid) {
+    return false;
+  }
+  if (cache.max_content_area != max_content_area[id] || cache.arranged_layout_size != layout_size[id] ||
+      cache.arranged_rect_size != rect_size[id]) {
+    return false;
+  }
+
+  // wrapped text reads the constraints of its parent
+  if (node->type == Node::Type::Text &&
+      (cache.parent_max_content_area != max_content_area[node->parent->id] ||
+       cache.parent_width_mode != computed[node->parent->id].width.mode)) {
+    return false;
+  }
+
+  layout_size[id] = cache.layout_size;
+  rect_size[id] = cache.rect_size;
+  content_size[id] = cache.content_size;
+  content_overflow[id] = cache.content_overflow;
+  return true;
+}
+
+} // namespace rugui
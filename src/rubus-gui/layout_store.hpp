@@ -0,0 +1,187 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <include/core/SkPoint.h>
+#include <include/core/SkSize.h>
+#include <include/core/SkMatrix.h>
+#include <include/core/SkRect.h>
+
+#include "node_style.hpp"
+
+namespace rugui {
+
+struct Node;
+struct TextMeasurer;
+struct ThreadPool;
+
+using NodeId = std::uint32_t;
+
+constexpr auto null_node_id = NodeId{0xFFFF'FFFF};
+
+struct FlexLine {
+  float width = 0;
+  float height = 0;
+  std::uint32_t first = 0; // Index of the first child in the line.
+  std::uint32_t count = 0; // Number of children in the line.
+};
+
+// Layout size of the children of a node added up and maxed along both axes. (added in child order)
+struct ChildSizes {
+  SkSize sum;
+  SkSize max;
+};
+
+// Style values resolved by `Node::layout_init`. (authored values are read from `Node::style`)
+struct ComputedStyle {
+  Size width;  // `{SizeMode::Self, 0}` when collapsed.
+  Size height; // `{SizeMode::Self, 0}` when collapsed.
+  FlexAlign flex_align = FlexAlign::Start;
+  FlexAlign flex_items_align = FlexAlign::Start;
+  FlexAlign flex_self_align = FlexAlign::Start;
+};
+
+// Layout of a node for the constraints it was last laid out with. (see `Node::is_layout_cached`)
+// NOTE: Only used while the node is clean, `Node::is_layout_dirty` invalidates it.
+struct LayoutCache {
+  // measure sweep
+  bool is_measure_valid = false;
+  SkSize parent_content_area; // Key, only compared for `SizeMode::Parent`.
+  ComputedStyle computed;
+  SkSize measured_layout_size;
+  SkSize measured_rect_size;
+  SkSize measured_content_size;
+
+  // arrange sweep
+  bool is_arrange_valid = false;
+  SkSize max_content_area;        // Key.
+  SkSize arranged_layout_size;    // Key, after the parent distributed its space.
+  SkSize arranged_rect_size;      // Key, after the parent distributed its space.
+  SkSize parent_max_content_area; // Key, only compared for text.
+  SizeMode parent_width_mode = SizeMode::Self; // Key, only compared for text.
+  SkSize layout_size;
+  SkSize rect_size;
+  SkSize content_size;
+  SkSize content_overflow;
+};
+
+// Layout columns of `LayoutStore`, swapped with the store by a time-sliced layout. (see `Node::layout_sliced`)
+struct LayoutBuffer {
+  std::vector<ComputedStyle> computed;
+  std::vector<SkPoint> pos;
+  std::vector<SkPoint> local_pos;
+  std::vector<SkSize> rect_size;
+  std::vector<SkSize> layout_size;
+  std::vector<SkSize> content_size;
+  std::vector<SkSize> content_overflow;
+  std::vector<SkSize> max_content_area;
+  std::vector<SkPoint> children_origin;
+  std::vector<std::vector<FlexLine>> flex_lines;
+  std::vector<float> text_layout_width;
+  std::vector<LayoutCache> layout_cache;
+};
+
+enum class LayoutPhase {
+  Idle,
+  Measure,
+  Arrange,
+  ResolvePos,
+};
+
+// Progress of a time-sliced layout.
+// NOTE: The store keeps the last completed layout between slices, the layout in progress is kept in `buffer`.
+struct SlicedLayout {
+  LayoutPhase phase = LayoutPhase::Idle;
+  Node *root = nullptr;
+  std::uint32_t cursor = 0; // Index in `LayoutStore::pre_order` the phase resumes at.
+  std::chrono::steady_clock::time_point deadline;
+  std::vector<NodeId> cleaned; // Nodes made clean by the layout in progress. (dirty again when it is canceled)
+  LayoutBuffer buffer;
+};
+
+// Layout output of every node in a tree, stored as parallel arrays indexed by `Node::id`.
+struct LayoutStore {
+  std::vector<Node *> nodes;
+  std::vector<ComputedStyle> computed;
+  std::vector<SkPoint> pos;
+  std::vector<SkPoint> local_pos; // `pos` relative to the parent. (set by `Node::layout_place_children`)
+  std::vector<SkSize> rect_size;
+  std::vector<SkSize> layout_size;
+  std::vector<SkSize> content_size;
+  std::vector<SkSize> content_overflow;
+  std::vector<SkSize> max_content_area;
+  std::vector<SkPoint> children_origin; // `pos` at the time the children were positioned.
+  std::vector<std::vector<FlexLine>> flex_lines;
+  std::vector<float> text_layout_width; // Width the paragraph settled on. (used for painting)
+  std::vector<LayoutCache> layout_cache;
+  std::vector<SkMatrix> screen_transform; // (set by `Node::calculate_screen_transform`)
+  std::vector<SkRect> clip_rect;          // (screen space, set by `Node::draw`)
+
+  std::vector<NodeId> free_ids;
+
+  // Called when a node is deleted, also when the library deletes it. (see `Node::drop_lazy_children`)
+  std::function<void(Node *)> on_release;
+
+  // Round `pos` and scroll to whole pixels and draw square rects on whole device pixels without anti-aliasing.
+  bool is_pixel_snapped = false;
+
+  // Traversal order of the tree, rebuilt by `update_order()` after the structure changed.
+  bool is_order_dirty = true;
+  std::vector<Node *> pre_order;
+  std::vector<std::uint32_t> pre_order_end;   // Index in `pre_order` past the subtree.
+  std::vector<std::uint32_t> pre_order_depth;
+  std::vector<Node *> level_order;
+  std::vector<std::uint32_t> level_order_depth;
+  std::vector<std::uint32_t> pre_order_index;   // (indexed by id)
+  std::vector<std::uint32_t> level_order_index; // (indexed by id)
+  std::vector<std::uint8_t> is_skipped;         // (indexed by id, used by `Node::bfs_with_level`)
+
+  std::vector<Node *> parallel_nodes; // Roots of subtrees laid out on the workers.
+  std::vector<Node *> list_nodes;     // Nodes of `Node::Type::List`.
+  std::vector<Node *> lazy_nodes;     // Nodes with `Node::lazy_drop_delay`.
+  std::vector<Node *> shape_queue;    // Text nodes whose text or font changed.
+  std::vector<Node *> resized_text;   // Text nodes with blocks shaped since the last layout.
+
+  SlicedLayout sliced_layout;
+
+  auto allocate(Node *node) -> NodeId;
+  auto release(NodeId id) -> void;
+  auto reset(NodeId id) -> void;
+
+  auto update_order(Node *node) -> void;
+
+  auto apply_text_block_sizes() -> void;
+  auto drop_lazy_children() -> void;
+  auto update_list_rows() -> bool;
+  auto shape_dirty_text(TextMeasurer *text_measurer, ThreadPool *thread_pool) -> void;
+
+  auto copy_layout(LayoutBuffer &buffer) -> void;
+  auto swap_layout(LayoutBuffer &buffer) -> void;
+  auto cancel_sliced_layout() -> void;
+
+  auto get_rect_pos(NodeId id) -> SkPoint;
+  auto get_content_area(NodeId id) -> SkSize;
+
+  auto get_margin_row(NodeId id) -> float;
+  auto get_margin_col(NodeId id) -> float;
+
+  auto get_padding_row(NodeId id) -> float;
+  auto get_padding_col(NodeId id) -> float;
+
+  auto accumulate_child_sizes(Node *node) -> ChildSizes;
+  auto calculate_flex_lines(Node *node, TextMeasurer *text_measurer) -> void;
+
+  auto begin_measure_cache(Node *node) -> void;
+  auto end_measure_cache(NodeId id) -> void;
+  auto find_measure_cache(Node *node, const ComputedStyle &computed) -> bool;
+  auto load_measure_cache(NodeId id) -> void;
+
+  auto begin_arrange_cache(Node *node) -> void;
+  auto end_arrange_cache(NodeId id) -> void;
+  auto find_arrange_cache(Node *node) -> bool;
+};
+
+} // namespace rugui
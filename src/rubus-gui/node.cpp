@@ -1,94 +1,63 @@
 #include "node.hpp"
 
 #include <ranges>
+#include <algorithm>
 #include <array>
 #include <stack>
-#include <queue>
 #include <format>
+#include <cmath>
 
 #include <include/core/SkRRect.h>
 
 namespace rugui {
 
-auto Node::bfs(const std::function<Traverse(Node *)> &fn) -> void {
-  auto queue = std::queue<Node *>{};
-  queue.emplace(this);
-  while (!queue.empty()) {
-    auto node = queue.front();
-    queue.pop();
-    auto result = fn(node);
-    if (result == Traverse::Break) {
-      break;
-    }
-    if (result == Traverse::SkipChildren) {
-      continue;
-    }
-    for (auto child : node->children) {
-      queue.emplace(child);
-    }
+ListRows::~ListRows() {
+  for (const auto row : free_rows) {
+    row->delete_all_children();
+    delete row;
   }
 }
 
-auto Node::dfs(const std::function<Traverse(Node *)> &fn) -> void {
-  auto stack = std::stack<Node *>{};
-  stack.emplace(this);
-  while (!stack.empty()) {
-    auto node = stack.top();
-    stack.pop();
-    auto result = fn(node);
-    if (result == Traverse::Break) {
-      break;
-    }
-    if (result == Traverse::SkipChildren) {
-      continue;
-    }
-    for (auto child : node->children | std::ranges::views::reverse) {
-      stack.emplace(child);
-    }
-  }
-}
+Node::Node(std::string_view name, ListSource source) : name{name}, type{Type::List} {
+  edit_style().flex_dir = FlexDir::Col;
+  list_rows = std::make_unique<ListRows>();
+  list_rows->source = std::move(source);
+  list_rows->is_rebind_needed = true;
 
-auto Node::bfs_with_level(const std::function<Traverse(Node *, int)> &fn) -> void {
-  auto level = 0;
-  auto queue = std::queue<Node *>{};
-  queue.emplace(this);
-  while (!queue.empty()) {
-    auto level_size = queue.size();
-    while (level_size-- != 0) {
-      auto node = queue.front();
-      queue.pop();
-      auto result = fn(node, level);
-      if (result == Traverse::Break) {
-        break;
-      }
-      if (result == Traverse::SkipChildren) {
-        continue;
-      }
-      for (auto child : node->children) {
-        queue.emplace(child);
-      }
-    }
-    ++level;
+  // spacers stand in for the rows above and below the viewport
+  for (auto i = 0; i < 2; ++i) {
+    const auto spacer = new Node{"list spacer"};
+    spacer->edit_style().width = Size::Parent(1);
+    spacer->parent = this;
+    children.push_back(spacer);
   }
 }
 
-auto Node::dfs_with_level(const std::function<Traverse(Node *, int)> &fn) -> void {
-  auto stack = std::stack<std::tuple<Node *, int>>{};
-  stack.emplace(this, 0);
-  while (!stack.empty()) {
-    auto [node, level] = stack.top();
-    stack.pop();
-    auto result = fn(node, level);
-    if (result == Traverse::Break) {
-      break;
-    }
-    if (result == Traverse::SkipChildren) {
-      continue;
-    }
-    for (auto child : node->children | std::ranges::views::reverse) {
-      stack.emplace(child, level + 1);
-    }
-  }
+Node::Node(std::string_view name, LogOptions options)
+    : Node{name, ListSource{
+                   .item_count = 0,
+                   .item_height = options.line_height,
+                   .overscan = 4,
+                   .make_row = [] { return (new Node{"log line", ""})->set_width(Size::Parent(1)); },
+                   .bind_row =
+                     [this](Node *row, std::size_t index) {
+                       // lines already shown before are not reshaped (see `ShapeCache`)
+                       if (row->style->font_size != style->font_size) {
+                         row->set_font_size(style->font_size);
+                       }
+                       row->set_color(style->color);
+                       row->set_text(list_rows->log_lines->lines[index]);
+                     },
+                 }} {
+  list_rows->log_lines = std::make_unique<LogLines>();
+  list_rows->log_lines->max_lines = std::max(options.max_lines, std::size_t{1});
+}
+
+Node::Node(std::string_view name, GridOptions options)
+    : name{name}, type{Type::Grid}, grid_data{std::make_unique<GridData>()} {
+  edit_style().width = {SizeMode::FitContent, 0};
+  edit_style().height = {SizeMode::FitContent, 0};
+  set_grid_size(options.rows, options.cols);
 }
 
 auto Node::tree_str_repr() -> std::string {
@@ -104,34 +73,81 @@ auto Node::tree_str_repr() -> std::string {
 }
 
 auto Node::check_mouse_inside(int mouse_x, int mouse_y) -> bool {
+  auto &store = *layout_store;
   auto is_in_clip = true;
-  if (output.style.is_clip_enabled && parent != nullptr) {
-    auto pos = parent->output.get_rect_pos();
-    auto rect = SkRect::MakeXYWH(pos.fX, pos.fY, parent->output.rect_size.fWidth, parent->output.rect_size.fHeight);
-    rect = parent->output.style.screen_transform.mapRect(rect);
+  if (style->is_clip_enabled && parent != nullptr) {
+    auto pos = store.get_rect_pos(parent->id);
+    auto size = store.rect_size[parent->id];
+    auto rect = SkRect::MakeXYWH(pos.fX, pos.fY, size.fWidth, size.fHeight);
+    rect = store.screen_transform[parent->id].mapRect(rect);
     is_in_clip = rect.contains((float)mouse_x, (float)mouse_y);
   }
 
   auto is_in_self = false;
   {
-    auto pos = output.get_rect_pos();
-    auto rect = SkRect::MakeXYWH(pos.fX, pos.fY, output.rect_size.fWidth, output.rect_size.fHeight);
-    rect = output.style.screen_transform.mapRect(rect);
+    auto pos = store.get_rect_pos(id);
+    auto rect = SkRect::MakeXYWH(pos.fX, pos.fY, store.rect_size[id].fWidth, store.rect_size[id].fHeight);
+    rect = store.screen_transform[id].mapRect(rect);
     is_in_self = rect.contains((float)mouse_x, (float)mouse_y);
   }
 
   return is_in_clip && is_in_self;
 }
 
+auto Node::mark_layout_dirty() -> void {
+  // ancestors of a dirty node are already dirty
+  auto node = this;
+  while (node != nullptr && !node->is_layout_dirty) {
+    node->is_layout_dirty = true;
+    node = node->parent;
+  }
+}
+
+auto Node::is_layout_boundary() -> bool {
+  // The size of this node is fixed and `layout_pass3` never resizes the parent,
+  // so the layout of this subtree does not depend on the rest of the tree.
+  if (style->width.mode != SizeMode::Self || style->height.mode != SizeMode::Self) {
+    return false;
+  }
+  if (parent != nullptr && parent->style->flex_wrap == FlexWrap::Wrap &&
+      (parent->style->width.mode == SizeMode::FitContent || parent->style->height.mode == SizeMode::FitContent)) {
+    return false;
+  }
+  return true;
+}
+
 auto Node::set_parent(Node *parent) -> Node * {
   this->parent = parent;
   return this;
 }
 
+auto Node::attach(LayoutStore *store) -> void {
+  dfs([&](Node *node) -> Traverse {
+    // children of an attached node are attached too
+    if (node->layout_store == store) {
+      return Traverse::SkipChildren;
+    }
+    if (node->layout_store != nullptr) {
+      node->layout_store->release(node->id);
+    }
+    node->layout_store = store;
+    node->id = store->allocate(node);
+    return Traverse::Continue;
+  });
+}
+
 auto Node::add(Node *node) -> Node * {
-  if (type != Type::Text) {
+  if (type == Type::Rect) {
+    if (layout_store != nullptr) {
+      node->attach(layout_store);
+    }
     node->parent = this;
+    node->is_layout_dirty = true;
     children.push_back(node);
+    mark_layout_dirty();
+    if (layout_store != nullptr) {
+      layout_store->is_order_dirty = true;
+    }
   }
   return this;
 }
@@ -150,195 +166,408 @@ auto Node::delete_all_children() -> void {
     delete node;
   }
   children.clear();
+  mark_layout_dirty();
+  if (layout_store != nullptr) {
+    layout_store->is_order_dirty = true;
+  }
+}
+
+auto Node::get_default_style(Type type) -> const NodeStyle & {
+  static const auto rect_style = NodeStyle{};
+  static const auto text_style = [] {
+    auto style = NodeStyle{};
+    style.color = SkColors::kBlack;
+    style.width = {SizeMode::FitContent, 0};
+    style.height = {SizeMode::FitContent, 0};
+    style.flex_dir = FlexDir::Row;
+    style.flex_wrap = FlexWrap::Wrap;
+    return style;
+  }();
+  return type == Type::Text ? text_style : rect_style;
+}
+
+auto Node::edit_style() -> NodeStyle & {
+  // copy the shared style the first time it is written to
+  if (own_style == nullptr) {
+    own_style = std::make_unique<NodeStyle>(*style);
+    style = own_style.get();
+  }
+  return *own_style;
 }
 
 auto Node::set_style(NodeStyle style) -> Node * {
-  this->style = style;
+  if (type == Type::Text && this->style->font_size != style.font_size) {
+    mark_paragraph_dirty();
+  }
+  const auto old_mode = display_mode;
+  display_mode = style.display_mode;
+  if (own_style == nullptr) {
+    own_style = std::make_unique<NodeStyle>(std::move(style));
+  } else {
+    *own_style = std::move(style);
+  }
+  this->style = own_style.get();
+  mark_layout_dirty();
+  update_lazy_children(old_mode);
+  return this;
+}
+
+auto Node::set_style_class(StyleClass *style_class) -> Node * {
+  // NOTE: Setting the style of the node directly overrides the class until the class changes.
+  if (this->style_class != nullptr) {
+    if (style_class == nullptr) {
+      // keep the style of the class
+      edit_style();
+    }
+    unlink_style_class();
+  }
+  this->style_class = style_class;
+  if (style_class != nullptr) {
+    style_class_index = style_class->nodes.size();
+    style_class->nodes.push_back(this);
+    apply_style_class(style_class->style);
+  }
+  return this;
+}
+
+auto Node::apply_style_class(const NodeStyle &style) -> void {
+  // NOTE: Called before the style of the class changes to `style`, the display mode and scroll of this node are kept.
+  if (type == Type::Text && this->style->font_size != style.font_size) {
+    mark_paragraph_dirty();
+  }
+  own_style = nullptr;
+  this->style = &style_class->style;
+  mark_layout_dirty();
+}
+
+auto Node::unlink_style_class() -> void {
+  auto &nodes = style_class->nodes;
+  nodes[style_class_index] = nodes.back();
+  nodes[style_class_index]->style_class_index = style_class_index;
+  nodes.pop_back();
+  style_class = nullptr;
+}
+
+auto Node::set_text(std::string_view text) -> Node * {
+  if (type == Type::Text && text_data->text != text) {
+    text_data->text = text;
+    mark_paragraph_dirty();
+    mark_layout_dirty();
+  }
+  return this;
+}
+
+auto Node::set_list_item_count(std::size_t count) -> Node * {
+  if (type == Type::List) {
+    list_rows->source.item_count = count;
+    list_rows->is_rebind_needed = true;
+    mark_layout_dirty();
+  }
+  return this;
+}
+
+auto Node::append_log(std::string_view text) -> Node * {
+  if (type != Type::List || list_rows->log_lines == nullptr) {
+    return this;
+  }
+
+  // - The first line of `text` continues the last line if it was not ended by a newline.
+  // - Only the rows in the viewport are bound again, so the cost does not grow with the log.
+  auto &log = *list_rows->log_lines;
+  while (!text.empty()) {
+    const auto end = text.find('\n');
+    const auto line = text.substr(0, end);
+    if (log.is_last_line_open) {
+      log.lines.back().append(line);
+    } else {
+      log.lines.emplace_back(line);
+    }
+    log.is_last_line_open = end == std::string_view::npos;
+    text = log.is_last_line_open ? std::string_view{} : text.substr(end + 1);
+  }
+
+  const auto dropped = log.lines.size() - std::min(log.lines.size(), log.max_lines);
+  log.lines.erase(log.lines.begin(), log.lines.begin() + (std::ptrdiff_t)dropped);
+
+  // keep the lines in view where they are (unless following the tail, see `update_list_rows()`)
+  if (!log.is_following_tail) {
+    vscroll_amount = std::min(vscroll_amount + (float)dropped * list_rows->source.item_height, 0.f);
+  }
+  return set_list_item_count(log.lines.size());
+}
+
+auto Node::set_grid_size(std::size_t rows, std::size_t cols) -> Node * {
+  if (type != Type::Grid || (grid_data->row_count == rows && grid_data->col_count == cols)) {
+    return this;
+  }
+
+  // keep the cells that are still inside
+  auto &grid = *grid_data;
+  auto cells = std::vector<GridCell>(rows * cols);
+  for (auto row = std::size_t{}; row < std::min(rows, grid.row_count); ++row) {
+    const auto first = grid.cells.begin() + (std::ptrdiff_t)(row * grid.col_count);
+    std::copy_n(first, std::min(cols, grid.col_count), cells.begin() + (std::ptrdiff_t)(row * cols));
+  }
+  grid.cells = std::move(cells);
+  grid.rows.assign(rows, GridRow{});
+  grid.row_count = rows;
+  grid.col_count = cols;
+  mark_layout_dirty();
+  return this;
+}
+
+auto Node::set_cell(std::size_t row, std::size_t col, GridCell cell) -> Node * {
+  if (type != Type::Grid || row >= grid_data->row_count || col >= grid_data->col_count) {
+    return this;
+  }
+
+  // only the row is built again, the layout does not change
+  auto &old_cell = grid_data->cells[row * grid_data->col_count + col];
+  if (old_cell != cell) {
+    old_cell = cell;
+    grid_data->rows[row].is_damaged = true;
+  }
+  return this;
+}
+
+auto Node::set_cells(std::size_t row, std::size_t col, std::string_view text, SkColor fg, SkColor bg) -> Node * {
+  // one code point per cell, cut at the end of the row
+  auto i = std::size_t{};
+  while (i < text.length() && type == Type::Grid && col < grid_data->col_count) {
+    set_cell(row, col++, {.ch = next_utf8(text, i), .fg = fg, .bg = bg});
+  }
+  return this;
+}
+
+auto Node::set_lazy_children(const std::function<void(Node *)> &build,
+                             std::optional<std::chrono::steady_clock::duration> drop_delay) -> Node * {
+  if (layout_store != nullptr && !lazy_drop_delay && drop_delay) {
+    layout_store->lazy_nodes.push_back(this);
+  }
+  if (layout_store != nullptr && lazy_drop_delay && !drop_delay) {
+    std::erase(layout_store->lazy_nodes, this);
+  }
+  lazy_build = build;
+  lazy_drop_delay = drop_delay;
+  collapsed_since = std::chrono::steady_clock::now();
+  update_lazy_children(DisplayMode::Collapsed);
   return this;
 }
 
 auto Node::set_display_mode(DisplayMode mode) -> Node * {
-  this->style.set_display_mode(mode);
+  // only collapsing affects the layout
+  if (display_mode != mode && (display_mode == DisplayMode::Collapsed || mode == DisplayMode::Collapsed)) {
+    mark_layout_dirty();
+  }
+  const auto old_mode = display_mode;
+  display_mode = mode;
+  update_lazy_children(old_mode);
   return this;
 }
 
 auto Node::set_local_transform(SkMatrix transform) -> Node * {
-  this->style.set_local_transform(transform);
+  edit_style().set_local_transform(transform);
   return this;
 }
 
 auto Node::set_screen_transform(SkMatrix transform) -> Node * {
-  this->style.set_screen_transform(transform);
+  edit_style().set_screen_transform(transform);
   return this;
 }
 
 auto Node::set_color(SkColor4f color) -> Node * {
-  this->style.set_color(color);
+  edit_style().set_color(color);
   return this;
 }
 
 auto Node::set_font_size(float size) -> Node * {
-  this->style.set_font_size(size);
+  if (type == Type::Text && style->font_size != size) {
+    mark_paragraph_dirty();
+  }
+  edit_style().set_font_size(size);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_image(sk_sp<SkImage> image) -> Node * {
-  this->style.set_image(image);
+  edit_style().set_image(image);
   return this;
 }
 
 auto Node::set_image_sampling(SkSamplingOptions image_sampling) -> Node * {
-  this->style.set_image_sampling(image_sampling);
+  edit_style().set_image_sampling(image_sampling);
   return this;
 }
 
 auto Node::set_vscroll(bool value) -> Node * {
-  this->style.set_vscroll(value);
+  edit_style().set_vscroll(value);
   return this;
 }
 
 auto Node::set_hscroll(bool value) -> Node * {
-  this->style.set_hscroll(value);
+  edit_style().set_hscroll(value);
   return this;
 }
 
 auto Node::set_clip_children(bool value) -> Node * {
-  this->style.set_clip_children(value);
+  edit_style().set_clip_children(value);
   return this;
 }
 
 auto Node::set_width(Size width) -> Node * {
-  this->style.set_width(width);
+  edit_style().set_width(width);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_height(Size height) -> Node * {
-  this->style.set_height(height);
+  edit_style().set_height(height);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_border_radius(float value) -> Node * {
-  this->style.set_border_radius(value);
+  edit_style().set_border_radius(value);
   return this;
 }
 
 auto Node::set_border_radius_tl(float value) -> Node * {
-  this->style.set_border_radius_tl(value);
+  edit_style().set_border_radius_tl(value);
   return this;
 }
 
 auto Node::set_border_radius_tr(float value) -> Node * {
-  this->style.set_border_radius_tr(value);
+  edit_style().set_border_radius_tr(value);
   return this;
 }
 
 auto Node::set_border_radius_br(float value) -> Node * {
-  this->style.set_border_radius_br(value);
+  edit_style().set_border_radius_br(value);
   return this;
 }
 
 auto Node::set_border_radius_bl(float value) -> Node * {
-  this->style.set_border_radius_bl(value);
+  edit_style().set_border_radius_bl(value);
   return this;
 }
 
 auto Node::set_margin(float value) -> Node * {
-  this->style.set_margin(value);
+  edit_style().set_margin(value);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_margin_row(float value) -> Node * {
-  this->style.set_margin_row(value);
+  edit_style().set_margin_row(value);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_margin_col(float value) -> Node * {
-  this->style.set_margin_col(value);
+  edit_style().set_margin_col(value);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_margin_t(float value) -> Node * {
-  this->style.set_margin_t(value);
+  edit_style().set_margin_t(value);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_margin_b(float value) -> Node * {
-  this->style.set_margin_b(value);
+  edit_style().set_margin_b(value);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_margin_r(float value) -> Node * {
-  this->style.set_margin_r(value);
+  edit_style().set_margin_r(value);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_margin_l(float value) -> Node * {
-  this->style.set_margin_l(value);
+  edit_style().set_margin_l(value);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_padding(float value) -> Node * {
-  this->style.set_padding(value);
+  edit_style().set_padding(value);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_padding_row(float value) -> Node * {
-  this->style.set_padding_row(value);
+  edit_style().set_padding_row(value);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_padding_col(float value) -> Node * {
-  this->style.set_padding_col(value);
+  edit_style().set_padding_col(value);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_padding_t(float value) -> Node * {
-  this->style.set_padding_t(value);
+  edit_style().set_padding_t(value);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_padding_b(float value) -> Node * {
-  this->style.set_padding_b(value);
+  edit_style().set_padding_b(value);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_padding_r(float value) -> Node * {
-  this->style.set_padding_r(value);
+  edit_style().set_padding_r(value);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_padding_l(float value) -> Node * {
-  this->style.set_padding_l(value);
+  edit_style().set_padding_l(value);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_flex_dir(FlexDir flex_dir) -> Node * {
-  this->style.set_flex_dir(flex_dir);
+  edit_style().set_flex_dir(flex_dir);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_flex_wrap(FlexWrap flex_wrap) -> Node * {
-  this->style.set_flex_wrap(flex_wrap);
+  edit_style().set_flex_wrap(flex_wrap);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_flex_align(FlexAlign align) -> Node * {
-  this->style.set_flex_align(align);
+  edit_style().set_flex_align(align);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_flex_items_align(FlexAlign align) -> Node * {
-  this->style.set_flex_items_align(align);
+  edit_style().set_flex_items_align(align);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_flex_content_align(FlexAlign align) -> Node * {
-  this->style.set_flex_content_align(align);
+  edit_style().set_flex_content_align(align);
+  mark_layout_dirty();
   return this;
 }
 
 auto Node::set_flex_self_align(FlexAlign align) -> Node * {
-  this->style.set_flex_self_align(align);
+  edit_style().set_flex_self_align(align);
+  mark_layout_dirty();
   return this;
 }
 
@@ -387,569 +616,963 @@ auto Node::set_on_mouse_click_out(const std::function<bool(Node *, MouseButton,
   return this;
 }
 
-auto Node::layout_pass1() -> std::vector<Node *> {
-  auto reverse_dfs_nodes = std::vector<Node *>{};
+auto Node::mark_paragraph_dirty() -> void {
+  text_data->is_paragraph_dirty = true;
 
-  // Pass 1:
-  // - Initialize the output based on style.
-  // - Determine basic size.
-  // - Determine max content area.
-  dfs([&](Node *node) -> Traverse {
-    reverse_dfs_nodes.push_back(node);
+  // shaped before the next layout measures it
+  if (layout_store != nullptr && !text_data->is_shape_queued) {
+    text_data->is_shape_queued = true;
+    layout_store->shape_queue.push_back(this);
+  }
+}
 
-    const auto parent = node->parent;
-    node->output = UiNodeOutput{node->style};
+auto Node::shape_paragraph(TextMeasurer *text_measurer, std::size_t worker) -> void {
+  text_measurer->shape(this, worker);
+  text_data->paragraph_memo.clear();
+  text_data->is_paragraph_dirty = false;
+}
 
-    // determine flex align
-    if (node->output.style.flex_align == FlexAlign::Inherit) {
-      node->output.style.flex_align = parent == nullptr ? FlexAlign::Start : parent->output.style.flex_align;
+auto Node::layout_paragraph(TextMeasurer *text_measurer, float width) -> ParagraphMetrics {
+  layout_store->text_layout_width[id] = width;
+  if (const auto metrics = text_data->paragraph_memo.find(width); metrics != nullptr) {
+    return *metrics;
+  }
+
+  const auto metrics = text_measurer->measure(this, width);
+  text_data->paragraph_memo.insert(metrics);
+  return metrics;
+}
+
+auto Node::update_list_rows() -> bool {
+  auto &store = *layout_store;
+  auto &rows = *list_rows;
+  const auto &source = rows.source;
+
+  // - Materialize the rows inside the viewport. (plus overscan)
+  // - Recycle the rows that left the viewport.
+  // - Resize the spacers to the estimated height of the rest.
+  // NOTE: Uses the size of the last layout, returns true if the children changed.
+
+  // the viewport is capped by the space given by the parent (so a FitContent list does not materialize every row)
+  const auto item_height = std::max(source.item_height, 1.f);
+  const auto viewport = std::max(std::min(store.get_content_area(id).fHeight, store.max_content_area[id].fHeight), 0.f);
+
+  // a log scrolled to the bottom stays there as lines are appended
+  // NOTE: The scroll is pinned to the overflow of the last layout, the estimated item height may be off.
+  //       The user scrolled away when the scroll is no longer where it was pinned.
+  auto is_following_tail = false;
+  if (rows.log_lines != nullptr) {
+    auto &log = *rows.log_lines;
+    const auto bottom = -std::max(store.content_overflow[id].fHeight, 0.f);
+    is_following_tail = (log.is_following_tail && vscroll_amount == log.tail_scroll) ||
+                        vscroll_amount <= bottom;
+    log.is_following_tail = is_following_tail;
+    if (is_following_tail) {
+      vscroll_amount = bottom;
+      log.tail_scroll = bottom;
     }
+  }
 
-    // determine flex items align
-    if (node->output.style.flex_items_align == FlexAlign::Inherit) {
-      node->output.style.flex_items_align =
-        parent == nullptr ? FlexAlign::Start : parent->output.style.flex_items_align;
+  const auto max_scroll = std::max((float)source.item_count * item_height - viewport, 0.f);
+  if (rows.is_rebind_needed && !is_following_tail) {
+    // the item count may have shrunk below the scroll position
+    vscroll_amount = std::max(vscroll_amount, -max_scroll);
+  }
+  const auto scroll = is_following_tail ? max_scroll : std::max(-vscroll_amount, 0.f);
+  const auto visible_first = (std::size_t)std::floor(scroll / item_height);
+  const auto visible_last = (std::size_t)std::ceil((scroll + viewport) / item_height);
+  const auto first = std::min(visible_first - std::min(visible_first, source.overscan), source.item_count);
+  const auto last = std::clamp(visible_last + source.overscan, first, source.item_count);
+
+  const auto top = children.front();
+  const auto bottom = children.back();
+  const auto old_rows = std::span{children}.subspan(1, children.size() - 2);
+  if (!rows.is_rebind_needed && rows.first == first && old_rows.size() == last - first) {
+    return false;
+  }
+
+  // keep the rows whose item is still in the window
+  auto new_rows = std::vector<Node *>(last - first, nullptr);
+  for (auto i = std::size_t{}; i < old_rows.size(); ++i) {
+    const auto index = rows.first + i;
+    if (!rows.is_rebind_needed && index >= first && index < last) {
+      new_rows[index - first] = old_rows[i];
+    } else {
+      old_rows[i]->parent = nullptr;
+      rows.free_rows.push_back(old_rows[i]);
     }
+  }
 
-    // determine flex self align
-    if (node->output.style.flex_self_align == FlexAlign::Inherit) {
-      node->output.style.flex_self_align = parent == nullptr ? FlexAlign::Start : parent->output.style.flex_items_align;
+  // bind the new items to recycled rows
+  for (auto i = std::size_t{}; i < new_rows.size(); ++i) {
+    if (new_rows[i] != nullptr) {
+      continue;
+    }
+    auto row = (Node *)nullptr;
+    if (!rows.free_rows.empty()) {
+      row = rows.free_rows.back();
+      rows.free_rows.pop_back();
+    } else {
+      row = source.make_row();
+      row->attach(layout_store);
     }
+    row->parent = this;
+    source.bind_row(row, first + i);
+    row->is_layout_dirty = true;
+    new_rows[i] = row;
+  }
 
-    // skip collapsed node
-    if (node->style.display_mode == DisplayMode::Collapsed) {
-      node->output.layout_size = {0, 0};
-      node->output.rect_size = {0, 0};
-      node->output.style.width = {SizeMode::Self, 0};
-      node->output.style.height = {SizeMode::Self, 0};
-      return Traverse::SkipChildren;
+  const auto top_height = (float)first * item_height;
+  const auto bottom_height = (float)(source.item_count - last) * item_height;
+  if (top->style->height.value != top_height) {
+    top->set_height(Size::Self(top_height));
+  }
+  if (bottom->style->height.value != bottom_height) {
+    bottom->set_height(Size::Self(bottom_height));
+  }
+
+  children.clear();
+  children.push_back(top);
+  children.insert(children.end(), new_rows.begin(), new_rows.end());
+  children.push_back(bottom);
+  rows.first = first;
+  rows.is_rebind_needed = false;
+
+  mark_layout_dirty();
+  store.is_order_dirty = true;
+  return true;
+}
+
+auto Node::update_lazy_children(DisplayMode old_mode) -> void {
+  if (!lazy_build || (old_mode == display_mode && old_mode != DisplayMode::Collapsed)) {
+    return;
+  }
+  if (display_mode == DisplayMode::Collapsed) {
+    if (old_mode != DisplayMode::Collapsed) {
+      collapsed_since = std::chrono::steady_clock::now();
     }
+  } else if (!is_lazy_built) {
+    is_lazy_built = true;
+    lazy_build(this);
+  }
+}
+
+auto Node::drop_lazy_children(std::chrono::steady_clock::time_point now) -> bool {
+  if (is_lazy_built && display_mode == DisplayMode::Collapsed && now - collapsed_since >= *lazy_drop_delay) {
+    delete_all_children();
+    is_lazy_built = false;
+    return true;
+  }
+  return false;
+}
 
-    const auto margin_row = node->output.get_margin_row();
-    const auto margin_col = node->output.get_margin_col();
+auto Node::layout_init(std::vector<Node *> *parallel_nodes) -> Traverse {
+  auto &store = *layout_store;
 
-    // determine width
-    switch (node->output.style.width.mode) {
-    case SizeMode::Self:
-      node->output.layout_size.fWidth = node->output.style.width.value + margin_row;
-      node->output.rect_size.fWidth = node->output.style.width.value;
-      break;
-    case SizeMode::Parent: {
-      if (parent != nullptr) {
-        node->output.layout_size.fWidth =
-          (parent->output.rect_size.fWidth - parent->output.get_padding_row()) * node->output.style.width.value;
-        node->output.rect_size.fWidth = node->output.layout_size.fWidth - margin_row;
-      }
-    } break;
-    case SizeMode::FitContent:
-      node->output.layout_size.fWidth = 0;
-      node->output.rect_size.fWidth = 0;
-      break;
+  // - Initialize the output based on the style.
+  // - Determine basic size.
+  // - Determine max content area.
+  // - Reuse the output of clean layout boundaries.
+  // - Defer the children of dirty layout boundaries to `parallel_nodes`. (if not null)
+
+  // resolve inherited flex align
+  auto flex_align = style->flex_align;
+  auto flex_items_align = style->flex_items_align;
+  auto flex_self_align = style->flex_self_align;
+  if (flex_align == FlexAlign::Inherit) {
+    flex_align = parent == nullptr ? FlexAlign::Start : store.computed[parent->id].flex_align;
+  }
+  if (flex_items_align == FlexAlign::Inherit) {
+    flex_items_align = parent == nullptr ? FlexAlign::Start : store.computed[parent->id].flex_items_align;
+  }
+  if (flex_self_align == FlexAlign::Inherit) {
+    flex_self_align = parent == nullptr ? FlexAlign::Start : store.computed[parent->id].flex_items_align;
+  }
+
+  // reuse clean layout boundary
+  is_layout_reused = false;
+  is_layout_parallel = false;
+  is_layout_cached = false;
+  if (parent != nullptr && !is_layout_dirty && display_mode != DisplayMode::Collapsed && is_layout_boundary()) {
+    auto max_content_area = store.get_content_area(parent->id);
+    max_content_area.fWidth -= style->margin_l + style->margin_r + style->padding_l + style->padding_r;
+    max_content_area.fHeight -= style->margin_t + style->margin_b + style->padding_t + style->padding_b;
+
+    if (store.max_content_area[id] == max_content_area && store.computed[id].flex_align == flex_align &&
+        store.computed[id].flex_items_align == flex_items_align &&
+        store.computed[id].flex_self_align == flex_self_align) {
+      is_layout_reused = true;
+      return Traverse::SkipChildren;
     }
+  }
 
-    // determine height
-    switch (node->output.style.height.mode) {
-    case SizeMode::Self:
-      node->output.layout_size.fHeight = node->output.style.height.value + margin_col;
-      node->output.rect_size.fHeight = node->output.style.height.value;
-      break;
-    case SizeMode::Parent: {
-      if (parent != nullptr) {
-        node->output.layout_size.fHeight =
-          (parent->output.rect_size.fHeight - parent->output.get_padding_col()) * node->output.style.height.value;
-        node->output.rect_size.fHeight = node->output.layout_size.fHeight - margin_col;
-      }
-    } break;
-    case SizeMode::FitContent:
-      node->output.layout_size.fHeight = 0;
-      node->output.rect_size.fHeight = 0;
-      break;
+  // reuse the measurement of clean node (the children are restored from the cache when needed)
+  const auto computed = ComputedStyle{
+    .width = style->width,
+    .height = style->height,
+    .flex_align = flex_align,
+    .flex_items_align = flex_items_align,
+    .flex_self_align = flex_self_align,
+  };
+  if (parent != nullptr && !is_layout_dirty && display_mode != DisplayMode::Collapsed &&
+      store.find_measure_cache(this, computed)) {
+    is_layout_cached = true;
+    return Traverse::SkipChildren;
+  }
+
+  // lay out independent subtree on a worker
+  if (parallel_nodes != nullptr && display_mode != DisplayMode::Collapsed && is_layout_boundary() &&
+      (!children.empty() || type == Type::Text)) {
+    is_layout_parallel = true;
+    parallel_nodes->push_back(this);
+  }
+  is_layout_dirty = false;
+
+  store.reset(id);
+  store.computed[id] = computed;
+  store.begin_measure_cache(this);
+
+  // skip collapsed node
+  if (display_mode == DisplayMode::Collapsed) {
+    store.layout_size[id] = {0, 0};
+    store.rect_size[id] = {0, 0};
+    store.computed[id].width = {SizeMode::Self, 0};
+    store.computed[id].height = {SizeMode::Self, 0};
+    store.end_measure_cache(id);
+    return Traverse::SkipChildren;
+  }
+
+  const auto margin_row = store.get_margin_row(id);
+  const auto margin_col = store.get_margin_col(id);
+
+  // determine width
+  switch (store.computed[id].width.mode) {
+  case SizeMode::Self:
+    store.layout_size[id].fWidth = store.computed[id].width.value + margin_row;
+    store.rect_size[id].fWidth = store.computed[id].width.value;
+    break;
+  case SizeMode::Parent: {
+    if (parent != nullptr) {
+      store.layout_size[id].fWidth =
+        (store.rect_size[parent->id].fWidth - store.get_padding_row(parent->id)) * store.computed[id].width.value;
+      store.rect_size[id].fWidth = store.layout_size[id].fWidth - margin_row;
     }
+  } break;
+  case SizeMode::FitContent:
+    store.layout_size[id].fWidth = 0;
+    store.rect_size[id].fWidth = 0;
+    break;
+  }
 
-    // determine max content area
+  // determine height
+  switch (store.computed[id].height.mode) {
+  case SizeMode::Self:
+    store.layout_size[id].fHeight = store.computed[id].height.value + margin_col;
+    store.rect_size[id].fHeight = store.computed[id].height.value;
+    break;
+  case SizeMode::Parent: {
     if (parent != nullptr) {
-      node->output.max_content_area = parent->output.get_content_area();
-      node->output.max_content_area.fWidth -= margin_row + node->output.get_padding_row();
-      node->output.max_content_area.fHeight -= margin_col + node->output.get_padding_col();
-    } else {
-      node->output.max_content_area = node->output.get_content_area();
+      store.layout_size[id].fHeight =
+        (store.rect_size[parent->id].fHeight - store.get_padding_col(parent->id)) * store.computed[id].height.value;
+      store.rect_size[id].fHeight = store.layout_size[id].fHeight - margin_col;
     }
+  } break;
+  case SizeMode::FitContent:
+    store.layout_size[id].fHeight = 0;
+    store.rect_size[id].fHeight = 0;
+    break;
+  }
 
-    return Traverse::Continue;
-  });
+  // determine max content area
+  if (parent != nullptr) {
+    store.max_content_area[id] = store.get_content_area(parent->id);
+    store.max_content_area[id].fWidth -= margin_row + store.get_padding_row(id);
+    store.max_content_area[id].fHeight -= margin_col + store.get_padding_col(id);
+  } else {
+    store.max_content_area[id] = store.get_content_area(id);
+  }
 
-  return reverse_dfs_nodes;
+  return is_layout_parallel ? Traverse::SkipChildren : Traverse::Continue;
 }
 
-auto Node::layout_pass2(std::span<Node *> reverse_dfs_nodes, SkiaRenderer *renderer) -> void {
-  // Pass 2:
+auto Node::layout_fit_content(TextMeasurer *text_measurer, std::size_t worker) -> void {
+  auto &store = *layout_store;
+
   // - Determine initial FitContent size.
   // - Determine initial content size.
-  for (auto node : reverse_dfs_nodes | std::ranges::views::reverse) {
-    if (node->output.style.display_mode == DisplayMode::Collapsed) {
-      continue;
-    }
-
-    auto &content_width = node->output.content_size.fWidth;
-    auto &content_height = node->output.content_size.fHeight;
-
-    switch (node->type) {
-    case Type::Rect: {
-      for (const auto child : node->children) {
-        switch (node->output.style.flex_dir) {
-        case FlexDir::Row:
-          content_width += child->output.layout_size.fWidth;
-          if (content_height < child->output.layout_size.fHeight) {
-            content_height = child->output.layout_size.fHeight;
-          }
-          break;
-        case FlexDir::Col:
-          if (content_width < child->output.layout_size.fWidth) {
-            content_width = child->output.layout_size.fWidth;
-          }
-          content_height += child->output.layout_size.fHeight;
-          break;
-        }
-      }
-    } break;
-    case Type::Text: {
-      auto paint = SkPaint{node->output.style.color};
-      paint.setAntiAlias(true);
-
-      auto text_style = skia::textlayout::TextStyle{};
-      text_style.setFontSize(node->output.style.font_size);
-      text_style.setForegroundPaint(paint);
-
-      auto builder =
-        skia::textlayout::ParagraphBuilder::make(skia::textlayout::ParagraphStyle{}, renderer->font_collection);
-      builder->pushStyle(text_style);
-      builder->addText(node->text.data(), node->text.length());
+  if (display_mode == DisplayMode::Collapsed) {
+    return;
+  }
 
-      node->paragraph = builder->Build();
-      node->paragraph->layout(std::numeric_limits<float>::infinity());
-      content_width = node->paragraph->getMaxIntrinsicWidth();
-      content_height = node->paragraph->getHeight();
-    } break;
-    }
+  auto &content_width = store.content_size[id].fWidth;
+  auto &content_height = store.content_size[id].fHeight;
 
-    // width
-    if (node->output.style.width.mode == SizeMode::FitContent) {
-      const auto margin_row = node->output.get_margin_row();
-      const auto padding_row = node->output.get_padding_row();
-      node->output.layout_size.fWidth = content_width + margin_row + padding_row;
-      node->output.rect_size.fWidth = content_width + padding_row;
+  switch (type) {
+  case Type::Rect:
+  case Type::List: {
+    const auto child_sizes = store.accumulate_child_sizes(this);
+    switch (style->flex_dir) {
+    case FlexDir::Row:
+      content_width = child_sizes.sum.fWidth;
+      content_height = child_sizes.max.fHeight;
+      break;
+    case FlexDir::Col:
+      content_width = child_sizes.max.fWidth;
+      content_height = child_sizes.sum.fHeight;
+      break;
     }
-    // height
-    if (node->output.style.height.mode == SizeMode::FitContent) {
-      const auto margin_col = node->output.get_margin_col();
-      const auto padding_col = node->output.get_padding_col();
-      node->output.layout_size.fHeight = content_height + margin_col + padding_col;
-      node->output.rect_size.fHeight = content_height + padding_col;
+  } break;
+  case Type::Text: {
+    // (text outside of `LayoutStore::shape_queue`, like the text inside a collapsed node when it was changed)
+    if (text_data->is_paragraph_dirty) {
+      shape_paragraph(text_measurer, worker);
     }
+    const auto metrics = layout_paragraph(text_measurer, std::numeric_limits<float>::infinity());
+    content_width = metrics.max_intrinsic_width;
+    content_height = metrics.height;
+  } break;
+  case Type::Grid: {
+    grid_data->cell_size = text_measurer->measure_cell(style->font_size);
+    content_width = grid_data->cell_size.fWidth * (float)grid_data->col_count;
+    content_height = grid_data->cell_size.fHeight * (float)grid_data->row_count;
+  } break;
   }
+
+  // width
+  if (store.computed[id].width.mode == SizeMode::FitContent) {
+    const auto margin_row = store.get_margin_row(id);
+    const auto padding_row = store.get_padding_row(id);
+    store.layout_size[id].fWidth = content_width + margin_row + padding_row;
+    store.rect_size[id].fWidth = content_width + padding_row;
+  }
+  // height
+  if (store.computed[id].height.mode == SizeMode::FitContent) {
+    const auto margin_col = store.get_margin_col(id);
+    const auto padding_col = store.get_padding_col(id);
+    store.layout_size[id].fHeight = content_height + margin_col + padding_col;
+    store.rect_size[id].fHeight = content_height + padding_col;
+  }
+
+  store.end_measure_cache(id);
 }
 
-auto Node::layout_pass3() -> void {
+auto Node::layout_distribute() -> void {
   // TODO: determine perpendicular fit wrap first
 
-  auto fit_wrap_nodes = std::vector<Node *>{};
-  auto fit_wrap_total_size = 0.f;
-  auto avaliable_size = 0.f;
+  auto &store = *layout_store;
 
-  // Pass 3:
-  // - Determine flex container size for Wrap + FitContent.
-  bfs([&](Node *node) -> Traverse {
-    const auto parent = node->parent;
-    if (parent == nullptr) {
-      return Traverse::Continue;
+  // - Determine flex container size of the children for Wrap + FitContent.
+  if (children.empty()) {
+    return;
+  }
+
+  // children that share the space left by their siblings
+  const auto is_fit_wrap = [&](Node *child) {
+    switch (style->flex_dir) {
+    case FlexDir::Row:
+      return child->style->flex_dir == FlexDir::Row && child->style->flex_wrap == FlexWrap::Wrap &&
+             store.computed[child->id].width.mode == SizeMode::FitContent;
+    case FlexDir::Col:
+      return child->style->flex_dir == FlexDir::Col && child->style->flex_wrap == FlexWrap::Wrap &&
+             store.computed[child->id].height.mode == SizeMode::FitContent;
     }
+    return false;
+  };
+
+  // set initial avaliable_size
+  auto fit_wrap_count = 0;
+  auto fit_wrap_total_size = 0.f;
+  auto avaliable_size = 0.f;
+  switch (style->flex_dir) {
+  case FlexDir::Row:
+    avaliable_size = store.max_content_area[id].fWidth;
+    break;
+  case FlexDir::Col:
+    avaliable_size = store.max_content_area[id].fHeight;
+    break;
+  }
 
-    auto &output = node->output;
+  for (const auto child : children) {
+    const auto child_id = child->id;
 
     // determine max content area
-    output.max_content_area = parent->output.get_content_area();
-    output.max_content_area.fWidth -= output.get_margin_row() + output.get_padding_row();
-    output.max_content_area.fHeight -= output.get_margin_col() + output.get_padding_col();
+    store.max_content_area[child_id] = store.get_content_area(id);
+    store.max_content_area[child_id].fWidth -= store.get_margin_row(child_id) + store.get_padding_row(child_id);
+    store.max_content_area[child_id].fHeight -= store.get_margin_col(child_id) + store.get_padding_col(child_id);
 
     // subtract overflow
-    if (output.style.flex_wrap == FlexWrap::Wrap) {
+    if (child->style->flex_wrap == FlexWrap::Wrap) {
       // width
-      if (output.style.width.mode == SizeMode::FitContent) {
-        if (output.content_size.fWidth > output.max_content_area.fWidth) {
-          auto overflow = output.content_size.fWidth - output.max_content_area.fWidth;
-          output.layout_size.fWidth -= overflow;
-          output.rect_size.fWidth -= overflow;
+      if (store.computed[child_id].width.mode == SizeMode::FitContent) {
+        if (store.content_size[child_id].fWidth > store.max_content_area[child_id].fWidth) {
+          auto overflow = store.content_size[child_id].fWidth - store.max_content_area[child_id].fWidth;
+          store.layout_size[child_id].fWidth -= overflow;
+          store.rect_size[child_id].fWidth -= overflow;
         }
       }
       // height
-      if (output.style.height.mode == SizeMode::FitContent) {
-        if (output.content_size.fHeight > output.max_content_area.fHeight) {
-          auto overflow = output.content_size.fHeight - output.max_content_area.fHeight;
-          output.layout_size.fHeight -= overflow;
-          output.rect_size.fHeight -= overflow;
+      if (store.computed[child_id].height.mode == SizeMode::FitContent) {
+        if (store.content_size[child_id].fHeight > store.max_content_area[child_id].fHeight) {
+          auto overflow = store.content_size[child_id].fHeight - store.max_content_area[child_id].fHeight;
+          store.layout_size[child_id].fHeight -= overflow;
+          store.rect_size[child_id].fHeight -= overflow;
         }
       }
     }
 
-    // set initial avaliable_size
-    if (node == parent->children.front()) {
-      fit_wrap_nodes.clear();
-      switch (parent->output.style.flex_dir) {
+    // update avaliable_size
+    if (is_fit_wrap(child)) {
+      ++fit_wrap_count;
+      switch (style->flex_dir) {
       case FlexDir::Row:
-        avaliable_size = parent->output.max_content_area.fWidth;
+        fit_wrap_total_size += store.content_size[child_id].fWidth;
         break;
       case FlexDir::Col:
-        avaliable_size = parent->output.max_content_area.fHeight;
+        fit_wrap_total_size += store.content_size[child_id].fHeight;
         break;
       }
-    }
-
-    // update avaliable_size
-    switch (parent->output.style.flex_dir) {
-    case FlexDir::Row:
-      if (output.style.flex_dir == FlexDir::Row && output.style.flex_wrap == FlexWrap::Wrap &&
-          output.style.width.mode == SizeMode::FitContent) {
-        fit_wrap_nodes.push_back(node);
-        fit_wrap_total_size += output.content_size.fWidth;
-      } else {
-        avaliable_size -= output.layout_size.fWidth;
-        if (avaliable_size < 0) {
-          avaliable_size = 0;
-        }
+    } else {
+      switch (style->flex_dir) {
+      case FlexDir::Row:
+        avaliable_size -= store.layout_size[child_id].fWidth;
+        break;
+      case FlexDir::Col:
+        avaliable_size -= store.layout_size[child_id].fHeight;
+        break;
       }
-      break;
-    case FlexDir::Col:
-      if (output.style.flex_dir == FlexDir::Col && output.style.flex_wrap == FlexWrap::Wrap &&
-          output.style.height.mode == SizeMode::FitContent) {
-        fit_wrap_nodes.push_back(node);
-        fit_wrap_total_size += output.content_size.fHeight;
-      } else {
-        avaliable_size -= output.layout_size.fHeight;
-        if (avaliable_size < 0) {
-          avaliable_size = 0;
-        }
+      if (avaliable_size < 0) {
+        avaliable_size = 0;
       }
-      break;
     }
+  }
 
-    if (node == parent->children.back()) {
-      // determine flex container size
-      for (const auto fit_wrap_node : fit_wrap_nodes) {
-        switch (parent->output.style.flex_dir) {
-        case FlexDir::Row: {
-          auto layout_width = (fit_wrap_node->output.content_size.fWidth / fit_wrap_total_size) * avaliable_size;
-          fit_wrap_node->output.layout_size.fWidth = layout_width;
-          fit_wrap_node->output.rect_size.fWidth = fit_wrap_node->output.layout_size.fWidth -
-                                                   fit_wrap_node->output.style.margin_l -
-                                                   fit_wrap_node->output.style.margin_r;
-        } break;
-        case FlexDir::Col: {
-          auto layout_height = (fit_wrap_node->output.content_size.fHeight / fit_wrap_total_size) * avaliable_size;
-          fit_wrap_node->output.layout_size.fHeight = layout_height;
-          fit_wrap_node->output.rect_size.fHeight = fit_wrap_node->output.layout_size.fHeight -
-                                                    fit_wrap_node->output.style.margin_t -
-                                                    fit_wrap_node->output.style.margin_b;
-        } break;
-        }
-      }
+  // determine flex container size
+  if (fit_wrap_count == 0) {
+    return;
+  }
+  for (const auto child : children) {
+    if (!is_fit_wrap(child)) {
+      continue;
     }
-
-    if (node->output.style.display_mode == DisplayMode::Collapsed) {
-      return Traverse::SkipChildren;
+    const auto child_id = child->id;
+    switch (style->flex_dir) {
+    case FlexDir::Row: {
+      auto layout_width = (store.content_size[child_id].fWidth / fit_wrap_total_size) * avaliable_size;
+      store.layout_size[child_id].fWidth = layout_width;
+      store.rect_size[child_id].fWidth = store.layout_size[child_id].fWidth - child->style->margin_l -
+                                         child->style->margin_r;
+    } break;
+    case FlexDir::Col: {
+      auto layout_height = (store.content_size[child_id].fHeight / fit_wrap_total_size) * avaliable_size;
+      store.layout_size[child_id].fHeight = layout_height;
+      store.rect_size[child_id].fHeight = store.layout_size[child_id].fHeight - child->style->margin_t -
+                                          child->style->margin_b;
+    } break;
     }
-    return Traverse::Continue;
-  });
+  }
 }
 
-auto Node::layout_pass4(std::span<Node *> reverse_dfs_nodes) -> void {
-  // Pass 4:
+auto Node::layout_flex_lines(TextMeasurer *text_measurer) -> void {
+  auto &store = *layout_store;
+
   // - Calculate flex lines.
   // - Determine final size.
-  for (auto node : reverse_dfs_nodes | std::ranges::views::reverse) {
-    if (node->output.style.display_mode == DisplayMode::Collapsed) {
-      continue;
+  store.calculate_flex_lines(this, text_measurer);
+
+  // width
+  if (store.computed[id].width.mode == SizeMode::FitContent) {
+    if (style->flex_dir == FlexDir::Col ||
+        (style->flex_dir == FlexDir::Row && store.get_content_area(id).fWidth > store.content_size[id].fWidth)) {
+      const auto margin_row = store.get_margin_row(id);
+      const auto padding_row = store.get_padding_row(id);
+      store.layout_size[id].fWidth = store.content_size[id].fWidth + margin_row + padding_row;
+      store.rect_size[id].fWidth = store.content_size[id].fWidth + padding_row;
     }
-    if (node->type == Type::Rect && node->children.empty()) {
-      continue;
+  }
+  // height
+  if (store.computed[id].height.mode == SizeMode::FitContent) {
+    if (style->flex_dir == FlexDir::Row ||
+        (style->flex_dir == FlexDir::Col && store.get_content_area(id).fHeight > store.content_size[id].fHeight)) {
+      const auto margin_col = store.get_margin_col(id);
+      const auto padding_col = store.get_padding_col(id);
+      store.layout_size[id].fHeight = store.content_size[id].fHeight + margin_col + padding_col;
+      store.rect_size[id].fHeight = store.content_size[id].fHeight + padding_col;
     }
+  }
+
+  // switch (style->flex_dir) {
+  // case FlexDirection::Row:
+  //   // height
+  //   if (store.computed[id].height.mode == SizeMode::FitContent) {
+  //     const auto margin_col = store.get_margin_col(id);
+  //     const auto padding_col = store.get_padding_col(id);
+  //     store.layout_size[id].fHeight = store.content_size[id].fHeight + margin_col + padding_col;
+  //     store.rect_size[id].fHeight = store.content_size[id].fHeight + padding_col;
+  //   }
+  //   break;
+  // case FlexDirection::Col:
+  //   // width
+  //   if (store.computed[id].width.mode == SizeMode::FitContent) {
+  //     const auto margin_row = store.get_margin_row(id);
+  //     const auto padding_row = store.get_padding_row(id);
+  //     store.layout_size[id].fWidth = store.content_size[id].fWidth + margin_row + padding_row;
+  //     store.rect_size[id].fWidth = store.content_size[id].fWidth + padding_row;
+  //   }
+  //   break;
+  // }
+}
 
-    node->output.calculate_flex_lines(node);
+auto Node::layout_place_children() -> void {
+  auto &store = *layout_store;
 
-    // width
-    if (node->output.style.width.mode == SizeMode::FitContent) {
-      if (node->output.style.flex_dir == FlexDir::Col ||
-          (node->output.style.flex_dir == FlexDir::Row &&
-           node->output.get_content_area().fWidth > node->output.content_size.fWidth)) {
-        const auto margin_row = node->output.get_margin_row();
-        const auto padding_row = node->output.get_padding_row();
-        node->output.layout_size.fWidth = node->output.content_size.fWidth + margin_row + padding_row;
-        node->output.rect_size.fWidth = node->output.content_size.fWidth + padding_row;
-      }
-    }
-    // height
-    if (node->output.style.height.mode == SizeMode::FitContent) {
-      if (node->output.style.flex_dir == FlexDir::Row ||
-          (node->output.style.flex_dir == FlexDir::Col &&
-           node->output.get_content_area().fHeight > node->output.content_size.fHeight)) {
-        const auto margin_col = node->output.get_margin_col();
-        const auto padding_col = node->output.get_padding_col();
-        node->output.layout_size.fHeight = node->output.content_size.fHeight + margin_col + padding_col;
-        node->output.rect_size.fHeight = node->output.content_size.fHeight + padding_col;
+  // - Set position of the children relative to this node based on the alignment settings.
+  if (children.empty()) {
+    return;
+  }
+
+  // set initial position
+  for (const auto child : children) {
+    store.local_pos[child->id] = {0, 0};
+  }
+
+  auto line_offset_x = 0.f;
+  auto line_offset_y = 0.f;
+
+  for (const auto &line : store.flex_lines[id]) {
+    auto align_offset_x = 0.f;
+    auto align_offset_y = 0.f;
+
+    const auto starting_pos_x = style->margin_l + style->padding_l;
+    const auto starting_pos_y = style->margin_t + style->padding_t;
+
+    // flex align (main axis align)
+    {
+      const auto remaining_width = store.get_content_area(id).fWidth - line.width;
+      const auto remaining_height = store.get_content_area(id).fHeight - line.height;
+
+      switch (store.computed[id].flex_align) {
+      case FlexAlign::Start: {
+        switch (style->flex_dir) {
+        case FlexDir::Row:
+          align_offset_x = starting_pos_x;
+          break;
+        case FlexDir::Col:
+          align_offset_y = starting_pos_y;
+          break;
+        }
+      } break;
+      case FlexAlign::Center: {
+        switch (style->flex_dir) {
+        case FlexDir::Row:
+          align_offset_x = starting_pos_x + remaining_width / 2.f;
+          break;
+        case FlexDir::Col:
+          align_offset_y = starting_pos_y + remaining_height / 2.f;
+          break;
+        }
+      } break;
+      case FlexAlign::End: {
+        switch (style->flex_dir) {
+        case FlexDir::Row:
+          align_offset_x = starting_pos_x + remaining_width;
+          break;
+        case FlexDir::Col:
+          align_offset_y = starting_pos_y + remaining_height;
+          break;
+        }
+      } break;
+      case FlexAlign::Inherit:
+        // unreachable
+        break;
       }
     }
 
-    // switch (node->output.style.flex_dir) {
-    // case FlexDirection::Row:
-    //   // height
-    //   if (node->output.style.height.mode == SizeMode::FitContent) {
-    //     const auto margin_col = node->output.get_margin_col();
-    //     const auto padding_col = node->output.get_padding_col();
-    //     node->output.layout_size.fHeight = node->output.content_size.fHeight + margin_col + padding_col;
-    //     node->output.rect_size.fHeight = node->output.content_size.fHeight + padding_col;
-    //   }
-    //   break;
-    // case FlexDirection::Col:
-    //   // width
-    //   if (node->output.style.width.mode == SizeMode::FitContent) {
-    //     const auto margin_row = node->output.get_margin_row();
-    //     const auto padding_row = node->output.get_padding_row();
-    //     node->output.layout_size.fWidth = node->output.content_size.fWidth + margin_row + padding_row;
-    //     node->output.rect_size.fWidth = node->output.content_size.fWidth + padding_row;
-    //   }
-    //   break;
-    // }
-  }
-}
-
-auto Node::layout_pass5() -> void {
-  // Pass 5:
-  // - Set position of nodes based on the alignment settings.
-  bfs([&](Node *node) -> Traverse {
-    const auto parent = node->parent;
-    if (parent == nullptr) {
-      return Traverse::Continue;
-    }
+    // flex content align (cross axis align all lines)
+    if (style->flex_wrap == FlexWrap::Wrap) {
+      const auto content_area = store.get_content_area(id);
+      const auto remaining_width = content_area.fWidth - store.content_size[id].fWidth;
+      const auto remaining_height = content_area.fHeight - store.content_size[id].fHeight;
 
-    // set initial position
-    node->output.pos.fX = parent->output.pos.fX;
-    node->output.pos.fY = parent->output.pos.fY;
-
-    if (node == parent->children.back()) {
-      auto line_offset_x = 0.f;
-      auto line_offset_y = 0.f;
-
-      for (const auto &line : parent->output.flex_lines) {
-        auto align_offset_x = 0.f;
-        auto align_offset_y = 0.f;
-
-        const auto starting_pos_x = parent->output.style.margin_l + parent->output.style.padding_l;
-        const auto starting_pos_y = parent->output.style.margin_t + parent->output.style.padding_t;
-
-        // flex align (main axis align)
-        {
-          const auto remaining_width = parent->output.get_content_area().fWidth - line.width;
-          const auto remaining_height = parent->output.get_content_area().fHeight - line.height;
-
-          switch (parent->output.style.flex_align) {
-          case FlexAlign::Start: {
-            switch (parent->output.style.flex_dir) {
-            case FlexDir::Row:
-              align_offset_x = starting_pos_x;
-              break;
-            case FlexDir::Col:
-              align_offset_y = starting_pos_y;
-              break;
-            }
-          } break;
-          case FlexAlign::Center: {
-            switch (parent->output.style.flex_dir) {
-            case FlexDir::Row:
-              align_offset_x = starting_pos_x + remaining_width / 2.f;
-              break;
-            case FlexDir::Col:
-              align_offset_y = starting_pos_y + remaining_height / 2.f;
-              break;
-            }
-          } break;
-          case FlexAlign::End: {
-            switch (parent->output.style.flex_dir) {
-            case FlexDir::Row:
-              align_offset_x = starting_pos_x + remaining_width;
-              break;
-            case FlexDir::Col:
-              align_offset_y = starting_pos_y + remaining_height;
-              break;
-            }
-          } break;
-          case FlexAlign::Inherit:
-            // unreachable
-            break;
-          }
+      switch (style->flex_content_align) {
+      case FlexAlign::Start: {
+        switch (style->flex_dir) {
+        case FlexDir::Row:
+          align_offset_y = starting_pos_y;
+          break;
+        case FlexDir::Col:
+          align_offset_x = starting_pos_x;
+          break;
         }
-
-        // flex content align (cross axis align all lines)
-        if (parent->output.style.flex_wrap == FlexWrap::Wrap) {
-          const auto remaining_width = parent->output.get_content_area().fWidth - parent->output.content_size.fWidth;
-          const auto remaining_height = parent->output.get_content_area().fHeight - parent->output.content_size.fHeight;
-
-          switch (parent->output.style.flex_content_align) {
-          case FlexAlign::Start: {
-            switch (parent->output.style.flex_dir) {
-            case FlexDir::Row:
-              align_offset_y = starting_pos_y;
-              break;
-            case FlexDir::Col:
-              align_offset_x = starting_pos_x;
-              break;
-            }
-          } break;
-          case FlexAlign::Center: {
-            switch (parent->output.style.flex_dir) {
-            case FlexDir::Row:
-              align_offset_y = starting_pos_y + remaining_height / 2.f;
-              break;
-            case FlexDir::Col:
-              align_offset_x = starting_pos_x + remaining_width / 2.f;
-              break;
-            }
-          } break;
-          case FlexAlign::End: {
-            switch (parent->output.style.flex_dir) {
-            case FlexDir::Row:
-              align_offset_y = starting_pos_y + remaining_height;
-              break;
-            case FlexDir::Col:
-              align_offset_x = starting_pos_x + remaining_width;
-              break;
-            }
-          } break;
-          case FlexAlign::Inherit:
-            // unreachable
-            break;
-          }
+      } break;
+      case FlexAlign::Center: {
+        switch (style->flex_dir) {
+        case FlexDir::Row:
+          align_offset_y = starting_pos_y + remaining_height / 2.f;
+          break;
+        case FlexDir::Col:
+          align_offset_x = starting_pos_x + remaining_width / 2.f;
+          break;
         }
+      } break;
+      case FlexAlign::End: {
+        switch (style->flex_dir) {
+        case FlexDir::Row:
+          align_offset_y = starting_pos_y + remaining_height;
+          break;
+        case FlexDir::Col:
+          align_offset_x = starting_pos_x + remaining_width;
+          break;
+        }
+      } break;
+      case FlexAlign::Inherit:
+        // unreachable
+        break;
+      }
+    }
 
-        // flex self align (cross axis align per line)
-        auto prev_node = (Node *)nullptr;
-        for (const auto &child : line.items) {
-          auto self_align_offset_x = 0.f;
-          auto self_align_offset_y = 0.f;
-
-          const auto avaliable_width =
-            parent->output.style.flex_wrap == FlexWrap::Wrap ? line.width : parent->output.get_content_area().fWidth;
-          const auto avaliable_height =
-            parent->output.style.flex_wrap == FlexWrap::Wrap ? line.height : parent->output.get_content_area().fHeight;
-
-          const auto remaining_width = avaliable_width - child->output.layout_size.fWidth;
-          const auto remaining_height = avaliable_height - child->output.layout_size.fHeight;
-
-          switch (child->output.style.flex_self_align) {
-          case FlexAlign::Start: {
-            switch (parent->output.style.flex_dir) {
-            case FlexDir::Row:
-              self_align_offset_y = parent->output.style.flex_wrap == FlexWrap::Wrap ? 0 : starting_pos_y;
-              break;
-            case FlexDir::Col:
-              self_align_offset_x = parent->output.style.flex_wrap == FlexWrap::Wrap ? 0 : starting_pos_x;
-              break;
-            }
-          } break;
-          case FlexAlign::Center: {
-            switch (parent->output.style.flex_dir) {
-            case FlexDir::Row:
-              self_align_offset_y =
-                (parent->output.style.flex_wrap == FlexWrap::Wrap ? 0 : starting_pos_y) + remaining_height / 2.f;
-              break;
-            case FlexDir::Col:
-              self_align_offset_x =
-                (parent->output.style.flex_wrap == FlexWrap::Wrap ? 0 : starting_pos_x) + remaining_width / 2.f;
-              break;
-            }
-          } break;
-          case FlexAlign::End: {
-            switch (parent->output.style.flex_dir) {
-            case FlexDir::Row:
-              self_align_offset_y =
-                (parent->output.style.flex_wrap == FlexWrap::Wrap ? 0 : starting_pos_y) + remaining_height;
-              break;
-            case FlexDir::Col:
-              self_align_offset_x =
-                (parent->output.style.flex_wrap == FlexWrap::Wrap ? 0 : starting_pos_x) + remaining_width;
-              break;
-            }
-          } break;
-          case FlexAlign::Inherit:
-            // unreachable
-            break;
-          }
+    // flex self align (cross axis align per line)
+    auto prev_node = (Node *)nullptr;
+    for (const auto child : std::span{children}.subspan(line.first, line.count)) {
+      auto self_align_offset_x = 0.f;
+      auto self_align_offset_y = 0.f;
 
-          // apply offset
-          child->output.pos.fX += line_offset_x + align_offset_x + self_align_offset_x;
-          child->output.pos.fY += line_offset_y + align_offset_y + self_align_offset_y;
-
-          switch (parent->output.style.flex_dir) {
-          case FlexDir::Row:
-            if (prev_node != nullptr) {
-              child->output.pos.fX = prev_node->output.pos.fX + prev_node->output.layout_size.fWidth;
-            }
-            break;
-          case FlexDir::Col:
-            if (prev_node != nullptr) {
-              child->output.pos.fY = prev_node->output.pos.fY + prev_node->output.layout_size.fHeight;
-            }
-            break;
-          }
-          prev_node = child;
-        }
+      const auto is_wrap = style->flex_wrap == FlexWrap::Wrap;
+      const auto avaliable_width = is_wrap ? line.width : store.get_content_area(id).fWidth;
+      const auto avaliable_height = is_wrap ? line.height : store.get_content_area(id).fHeight;
+
+      const auto remaining_width = avaliable_width - store.layout_size[child->id].fWidth;
+      const auto remaining_height = avaliable_height - store.layout_size[child->id].fHeight;
 
-        switch (parent->output.style.flex_dir) {
+      switch (store.computed[child->id].flex_self_align) {
+      case FlexAlign::Start: {
+        switch (style->flex_dir) {
+        case FlexDir::Row:
+          self_align_offset_y = style->flex_wrap == FlexWrap::Wrap ? 0 : starting_pos_y;
+          break;
+        case FlexDir::Col:
+          self_align_offset_x = style->flex_wrap == FlexWrap::Wrap ? 0 : starting_pos_x;
+          break;
+        }
+      } break;
+      case FlexAlign::Center: {
+        switch (style->flex_dir) {
         case FlexDir::Row:
-          line_offset_y += line.height;
+          self_align_offset_y = (style->flex_wrap == FlexWrap::Wrap ? 0 : starting_pos_y) + remaining_height / 2.f;
           break;
         case FlexDir::Col:
-          line_offset_x += line.width;
+          self_align_offset_x = (style->flex_wrap == FlexWrap::Wrap ? 0 : starting_pos_x) + remaining_width / 2.f;
           break;
         }
+      } break;
+      case FlexAlign::End: {
+        switch (style->flex_dir) {
+        case FlexDir::Row:
+          self_align_offset_y = (style->flex_wrap == FlexWrap::Wrap ? 0 : starting_pos_y) + remaining_height;
+          break;
+        case FlexDir::Col:
+          self_align_offset_x = (style->flex_wrap == FlexWrap::Wrap ? 0 : starting_pos_x) + remaining_width;
+          break;
+        }
+      } break;
+      case FlexAlign::Inherit:
+        // unreachable
+        break;
       }
 
-      // calculate overflow for scrolling
-      {
-        const auto right = parent->output.pos.fX + parent->output.style.margin_l + parent->output.rect_size.fWidth -
-                           parent->output.style.padding_r;
-        const auto bottom = parent->output.pos.fY + parent->output.style.margin_t + parent->output.rect_size.fHeight -
-                            parent->output.style.padding_b;
-
-        if (!parent->children.empty()) {
-          auto content_right = node->output.pos.fX + node->output.layout_size.fWidth;
-          auto content_bottom = node->output.pos.fY + node->output.layout_size.fHeight;
-          parent->output.content_overflow.fWidth = content_right - right;
-          parent->output.content_overflow.fHeight = content_bottom - bottom;
-        } else {
-          parent->output.content_overflow.fWidth = 0;
-          parent->output.content_overflow.fHeight = 0;
+      // apply offset
+      store.local_pos[child->id].fX += line_offset_x + align_offset_x + self_align_offset_x;
+      store.local_pos[child->id].fY += line_offset_y + align_offset_y + self_align_offset_y;
+
+      switch (style->flex_dir) {
+      case FlexDir::Row:
+        if (prev_node != nullptr) {
+          store.local_pos[child->id].fX =
+            store.local_pos[prev_node->id].fX + store.layout_size[prev_node->id].fWidth;
         }
+        break;
+      case FlexDir::Col:
+        if (prev_node != nullptr) {
+          store.local_pos[child->id].fY =
+            store.local_pos[prev_node->id].fY + store.layout_size[prev_node->id].fHeight;
+        }
+        break;
+      }
+      prev_node = child;
+    }
+
+    switch (style->flex_dir) {
+    case FlexDir::Row:
+      line_offset_y += line.height;
+      break;
+    case FlexDir::Col:
+      line_offset_x += line.width;
+      break;
+    }
+  }
+
+  // calculate overflow for scrolling
+  {
+    const auto last_id = children.back()->id;
+    const auto right = style->margin_l + store.rect_size[id].fWidth - style->padding_r;
+    const auto bottom = style->margin_t + store.rect_size[id].fHeight - style->padding_b;
+    const auto content_right = store.local_pos[last_id].fX + store.layout_size[last_id].fWidth;
+    const auto content_bottom = store.local_pos[last_id].fY + store.layout_size[last_id].fHeight;
+    store.content_overflow[id].fWidth = content_right - right;
+    store.content_overflow[id].fHeight = content_bottom - bottom;
+  }
+
+  // clamp scroll
+  if (store.content_overflow[id].fHeight > 0) {
+    const auto min_y = -store.content_overflow[id].fHeight;
+    vscroll_amount = std::clamp(vscroll_amount, min_y, 0.f);
+  }
+}
+
+auto Node::layout_measure(TextMeasurer *text_measurer, std::size_t worker, std::vector<Node *> *parallel_nodes,
+                          SlicedLayout *slice) -> bool {
+  // Sweep 1: (sizes from the children)
+  // - On enter: `layout_init()`.
+  // - On exit: `layout_fit_content()`.
+  return dfs_with_exit(
+    [&](Node *node) -> Traverse {
+      if (slice != nullptr && node->is_layout_dirty) {
+        slice->cleaned.push_back(node->id);
+      }
+      return node->layout_init(node == this ? nullptr : parallel_nodes);
+    },
+    [&](Node *node) {
+      if (!node->is_layout_reused && !node->is_layout_parallel && !node->is_layout_cached) {
+        node->layout_fit_content(text_measurer, worker);
+      }
+    },
+    slice);
+}
+
+auto Node::layout_arrange(TextMeasurer *text_measurer, SlicedLayout *slice) -> bool {
+  // Sweep 2: (sizes from the parent, then final sizes and positions from the children)
+  // - On enter: `layout_distribute()`, or reuse the cached layout of the node.
+  // - On exit: `layout_flex_lines()` and `layout_place_children()`.
+  return dfs_with_exit(
+    [&](Node *node) -> Traverse {
+      if (node->parent != nullptr &&
+          (node->display_mode == DisplayMode::Collapsed || node->is_layout_reused)) {
+        return Traverse::SkipChildren;
+      }
+      // laid out by a worker
+      if (node != this && node->is_layout_parallel) {
+        return Traverse::SkipChildren;
       }
 
-      // clamp scroll
-      if (parent->output.content_overflow.fHeight > 0) {
-        const auto min_y = -parent->output.content_overflow.fHeight;
-        parent->style.vscroll_amount = std::clamp(parent->style.vscroll_amount, min_y, 0.f);
+      auto &store = *layout_store;
+      if (node->is_layout_cached) {
+        // same constraints as last time
+        if (store.find_arrange_cache(node)) {
+          node->is_layout_reused = true;
+          return Traverse::SkipChildren;
+        }
+        // NOTE: The children of a cached node were measured together with it.
+        store.flex_lines[node->id].clear();
+        for (const auto child : node->children) {
+          store.load_measure_cache(child->id);
+          child->is_layout_reused = false;
+          child->is_layout_parallel = false;
+          child->is_layout_cached = true;
+        }
       }
+
+      store.begin_arrange_cache(node);
+      node->layout_distribute();
+      return Traverse::Continue;
+    },
+    [&](Node *node) {
+      if (node->display_mode == DisplayMode::Collapsed || node->is_layout_reused) {
+        return;
+      }
+      if (node != this && node->is_layout_parallel) {
+        return;
+      }
+      if ((node->type != Type::Rect && node->type != Type::Grid) || !node->children.empty()) {
+        node->layout_flex_lines(text_measurer);
+        node->layout_place_children();
+      }
+      layout_store->end_arrange_cache(node->id);
+    },
+    slice);
+}
+
+auto Node::layout_resolve_pos(SlicedLayout *slice) -> bool {
+  auto &store = *layout_store;
+
+  // - Convert the positions relative to the parent to absolute positions.
+  const auto resolve_pos = [&](Node *node) -> Traverse {
+    if (node->parent != nullptr && node->display_mode == DisplayMode::Collapsed) {
+      return Traverse::SkipChildren;
     }
 
-    if (node->output.style.display_mode == DisplayMode::Collapsed) {
+    const auto node_id = node->id;
+
+    // children of a reused node that did not move are already in place
+    if (node->is_layout_reused && store.pos[node_id] == store.children_origin[node_id]) {
       return Traverse::SkipChildren;
     }
+
+    for (const auto child : node->children) {
+      store.pos[child->id] = store.pos[node_id] + store.local_pos[child->id];
+    }
+    if (store.is_pixel_snapped) {
+      // NOTE: Only the absolute positions are rounded, the layout keeps working with the exact sizes.
+      for (const auto child : node->children) {
+        store.pos[child->id] = {std::round(store.pos[child->id].fX), std::round(store.pos[child->id].fY)};
+      }
+    }
+    store.children_origin[node_id] = store.pos[node_id];
+
     return Traverse::Continue;
-  });
+  };
+
+  if (slice != nullptr) {
+    return dfs_with_exit(resolve_pos, [](Node *) {}, slice);
+  }
+  dfs(resolve_pos);
+  return true;
+}
+
+auto Node::layout(TextMeasurer *text_measurer, ThreadPool *thread_pool) -> void {
+  auto &store = *layout_store;
+
+  // replaces the sliced layout in progress
+  store.cancel_sliced_layout();
+
+  text_measurer->update();
+  store.apply_text_block_sizes();
+  store.drop_lazy_children();
+  store.update_list_rows();
+
+  if (!is_layout_dirty) {
+    return;
+  }
+
+  store.shape_dirty_text(text_measurer, thread_pool);
+  layout_tree(text_measurer, thread_pool);
+
+  // a list resized by the layout shows a different range of rows (settles in one more pass)
+  if (store.update_list_rows() && is_layout_dirty) {
+    layout_tree(text_measurer, thread_pool);
+  }
+}
+
+auto Node::layout_sliced(TextMeasurer *text_measurer, std::chrono::steady_clock::duration budget) -> bool {
+  auto &store = *layout_store;
+  auto &slice = store.sliced_layout;
+
+  // - Runs the sweeps of `layout()` until `budget` is spent, then resumes on the next call.
+  // - The store keeps the last completed layout between calls, so it can be drawn and hit tested.
+  // - Returns true when the new layout was completed.
+  // NOTE: Independent subtrees are not laid out in parallel, the slices run on the calling thread.
+
+  // the tree changed since the last slice, start over
+  if (slice.phase != LayoutPhase::Idle && (slice.root != this || store.is_order_dirty)) {
+    store.cancel_sliced_layout();
+  }
+
+  if (slice.phase == LayoutPhase::Idle) {
+    text_measurer->update();
+    store.apply_text_block_sizes();
+    store.drop_lazy_children();
+    store.update_list_rows();
+    if (!is_layout_dirty) {
+      return false;
+    }
+
+    store.shape_dirty_text(text_measurer, nullptr);
+
+    store.update_order(this);
+    store.copy_layout(slice.buffer);
+    slice.phase = LayoutPhase::Measure;
+    slice.root = this;
+    slice.cursor = store.pre_order_index[id];
+  }
+
+  slice.deadline = std::chrono::steady_clock::now() + budget;
+  store.swap_layout(slice.buffer);
+
+  const auto first = store.pre_order_index[id];
+  auto is_done = false;
+  for (auto is_paused = false; !is_paused && !is_done;) {
+    switch (slice.phase) {
+    case LayoutPhase::Idle:
+      is_done = true;
+      break;
+    case LayoutPhase::Measure:
+      is_paused = !layout_measure(text_measurer, 0, nullptr, &slice);
+      if (!is_paused) {
+        slice.phase = LayoutPhase::Arrange;
+        slice.cursor = first;
+      }
+      break;
+    case LayoutPhase::Arrange:
+      is_paused = !layout_arrange(text_measurer, &slice);
+      if (!is_paused) {
+        slice.phase = LayoutPhase::ResolvePos;
+        slice.cursor = first;
+      }
+      break;
+    case LayoutPhase::ResolvePos:
+      is_paused = !layout_resolve_pos(&slice);
+      is_done = !is_paused;
+      break;
+    }
+  }
+
+  if (!is_done) {
+    // keep drawing the last completed layout
+    store.swap_layout(slice.buffer);
+    return false;
+  }
+
+  // commit (the buffer is left with the old layout)
+  slice.phase = LayoutPhase::Idle;
+  slice.root = nullptr;
+  slice.cleaned.clear();
+  return true;
+}
+
+auto Node::layout_tree(TextMeasurer *text_measurer, ThreadPool *thread_pool) -> void {
+  auto &store = *layout_store;
+  store.update_order(this);
+
+  // lay out everything except the inside of independent subtrees
+  store.parallel_nodes.clear();
+  layout_measure(text_measurer, 0, &store.parallel_nodes);
+  layout_arrange(text_measurer);
+
+  // lay out independent subtrees in parallel
+  // (their size is fixed so the rest of the tree only needs their max content area, set by `layout_arrange`)
+  const auto layout_subtree = [&](std::size_t index, std::size_t worker) {
+    const auto node = store.parallel_nodes[index];
+    for (const auto child : node->children) {
+      child->layout_measure(text_measurer, worker, nullptr);
+    }
+    node->layout_fit_content(text_measurer, worker);
+    node->layout_arrange(text_measurer);
+  };
+  if (thread_pool != nullptr) {
+    thread_pool->run(store.parallel_nodes.size(), layout_subtree);
+  } else {
+    for (auto i = std::size_t{}; i < store.parallel_nodes.size(); ++i) {
+      layout_subtree(i, 0);
+    }
+  }
+
+  layout_resolve_pos();
 }
 
 auto Node::layout(SkiaRenderer *renderer) -> void {
-  auto reverse_dfs_nodes = layout_pass1();
-  layout_pass2(reverse_dfs_nodes, renderer);
-  layout_pass3();
-  layout_pass4(reverse_dfs_nodes);
-  layout_pass5();
+  layout(&renderer->text_measurer, &renderer->layout_thread_pool);
+}
+
+auto Node::layout_sliced(SkiaRenderer *renderer, std::chrono::steady_clock::duration budget) -> bool {
+  return layout_sliced(&renderer->text_measurer, budget);
 }
 
 auto Node::run_mouse_enter_event(int mouse_x, int mouse_y) -> void {
@@ -1132,62 +1755,98 @@ auto Node::run_mouse_click_out_event(MouseButton button, int mouse_x, int mouse_
 }
 
 auto Node::calculate_screen_transform() -> void {
-  switch (output.style.transform_mode) {
+  auto &store = *layout_store;
+  switch (style->transform_mode) {
   case TransformMode::Local: {
     if (parent != nullptr) {
-      // calculate scroll
-      output.style.transform = style.transform * SkMatrix::I().Translate(SkVector{parent->output.style.hscroll_amount,
-                                                                                  parent->output.style.vscroll_amount});
+      // calculate scroll (whole pixels when snapped, so the snapped positions stay on the pixel grid)
+      auto scroll = SkVector{parent->hscroll_amount, parent->vscroll_amount};
+      if (store.is_pixel_snapped) {
+        scroll = {std::round(scroll.fX), std::round(scroll.fY)};
+      }
+      const auto transform = style->transform * SkMatrix::I().Translate(scroll);
 
       // calculate screen transform
-      output.style.screen_transform = parent->output.style.screen_transform * output.style.transform;
+      store.screen_transform[id] = store.screen_transform[parent->id] * transform;
     } else {
       // calculate screen transform
-      output.style.screen_transform = output.style.transform;
+      store.screen_transform[id] = style->transform;
     }
   } break;
   case TransformMode::Screen: {
-    output.style.screen_transform = output.style.transform;
-    output.pos = {0, 0};
+    store.screen_transform[id] = style->transform;
+    store.pos[id] = {0, 0};
   } break;
   }
 }
 
 auto Node::draw(SkiaRenderer *renderer) -> void {
+  auto &store = *layout_store;
   const auto canvas = renderer->canvas;
 
   switch (type) {
-  case Type::Rect: {
-    auto paint = SkPaint{output.style.color};
-    paint.setAntiAlias(true);
+  case Type::Rect:
+  case Type::List:
+  case Type::Grid: {
+    auto paint = SkPaint{style->color};
 
     // draw rect
-    const auto corners = std::array{SkVector{output.style.border_radius_tl, output.style.border_radius_tl},
-                                    SkVector{output.style.border_radius_tr, output.style.border_radius_tr},
-                                    SkVector{output.style.border_radius_br, output.style.border_radius_br},
-                                    SkVector{output.style.border_radius_bl, output.style.border_radius_bl}};
-    const auto rect_pos = output.get_rect_pos();
-    const auto rect = SkRect::MakeXYWH(rect_pos.fX, rect_pos.fY, output.rect_size.fWidth, output.rect_size.fHeight);
-    auto rrect = SkRRect::MakeEmpty();
-    rrect.setRectRadii(rect, corners.data());
-    canvas->drawRRect(rrect, paint);
+    const auto rect_pos = store.get_rect_pos(id);
+    const auto rect_size = store.rect_size[id];
+    auto rect = SkRect::MakeXYWH(rect_pos.fX, rect_pos.fY, rect_size.fWidth, rect_size.fHeight);
+    const auto matrix = canvas->getTotalMatrix();
+    auto inverse = SkMatrix{};
+    if (store.is_pixel_snapped && style->border_radius_tl == 0 && style->border_radius_tr == 0 &&
+        style->border_radius_br == 0 && style->border_radius_bl == 0 && matrix.isScaleTranslate() &&
+        matrix.invert(&inverse)) {
+      // edges are rounded to whole device pixels, no coverage to compute
+      // NOTE: The transform may scale or scroll by a fraction of a pixel, so the rect is snapped after it is mapped.
+      const auto device_rect = matrix.mapRect(rect).round();
+      rect = inverse.mapRect(SkRect::Make(device_rect));
+      canvas->save();
+      canvas->resetMatrix();
+      canvas->drawIRect(device_rect, paint);
+      canvas->restore();
+    } else {
+      const auto corners = std::array{SkVector{style->border_radius_tl, style->border_radius_tl},
+                                      SkVector{style->border_radius_tr, style->border_radius_tr},
+                                      SkVector{style->border_radius_br, style->border_radius_br},
+                                      SkVector{style->border_radius_bl, style->border_radius_bl}};
+      auto rrect = SkRRect::MakeEmpty();
+      rrect.setRectRadii(rect, corners.data());
+      paint.setAntiAlias(true);
+      canvas->drawRRect(rrect, paint);
+    }
 
     // draw image
-    if (output.style.image != nullptr) {
-      const auto image_rect = SkRect::MakeXYWH(rect_pos.fX + output.style.padding_l,               //
-                                               rect_pos.fY + output.style.padding_t,               //
-                                               output.rect_size.fWidth - output.get_padding_col(), //
-                                               output.rect_size.fHeight - output.get_padding_row() //
+    if (style->image != nullptr) {
+      const auto image_rect = SkRect::MakeXYWH(rect_pos.fX + style->padding_l,               //
+                                               rect_pos.fY + style->padding_t,               //
+                                               store.rect_size[id].fWidth - store.get_padding_col(id), //
+                                               store.rect_size[id].fHeight - store.get_padding_row(id) //
       );
-      canvas->drawImageRect(output.style.image, image_rect, output.style.image_sampling);
+      canvas->drawImageRect(style->image, image_rect, style->image_sampling);
     }
 
     // update clip rect
-    output.style.clip_rect = rect;
+    store.clip_rect[id] = rect;
+
+    // draw cells (over the background)
+    if (type == Type::Grid) {
+      draw_grid(renderer);
+    }
   } break;
   case Type::Text: {
-    auto pos = output.get_rect_pos();
-    paragraph->paint(canvas, pos.fX, pos.fY);
+    if (text_data->blocks != nullptr) {
+      draw_text_blocks(renderer);
+      break;
+    }
+
+    // not shaped (laid out with a measurer that does not build paragraphs, or still shaped in the background)
+    if (text_data->paragraph == nullptr) {
+      break;
+    }
+    renderer->text_measurer.paint(this, canvas, store.get_rect_pos(id), store.text_layout_width[id]);
   } break;
   }
 
@@ -1195,33 +1854,200 @@ auto Node::draw(SkiaRenderer *renderer) -> void {
   // if (renderer->show_debug_lines) {
   //   canvas->save();
   //   {
-  //     canvas->setMatrix(output.style.screen_transform);
+  //     canvas->setMatrix(store.screen_transform[id]);
 
   //     // draw layout rect
   //     auto paint = SkPaint{SkColors::kDkGray};
   //     paint.setStyle(SkPaint::kStroke_Style);
   //     paint.setStrokeWidth(1);
+  //     auto layout_size = store.layout_size[id];
   //     canvas->drawRect(
-  //       SkRect::MakeXYWH(output.pos.fX, output.pos.fY, output.layout_size.fWidth, output.layout_size.fHeight),
-  //       paint);
+  //       SkRect::MakeXYWH(store.pos[id].fX, store.pos[id].fY, layout_size.fWidth, layout_size.fHeight), paint);
 
   //     // draw padding rect
   //     paint.setColor(SkColors::kMagenta);
   //     paint.setStyle(SkPaint::kStroke_Style);
   //     paint.setStrokeWidth(1);
-  //     auto rect_pos = output.get_rect_pos();
-  //     auto padding_row = output.style.padding_l + output.style.padding_r;
-  //     auto padding_col = output.style.padding_t + output.style.padding_b;
-  //     canvas->drawRect(SkRect::MakeXYWH(rect_pos.fX + output.style.padding_l, rect_pos.fY + output.style.padding_t,
-  //                                       output.rect_size.fWidth - padding_row, output.rect_size.fHeight -
-  //                                       padding_col),
+  //     auto rect_pos = store.get_rect_pos(id);
+  //     auto padding_row = style->padding_l + style->padding_r;
+  //     auto padding_col = style->padding_t + style->padding_b;
+  //     auto rect_size = store.rect_size[id];
+  //     canvas->drawRect(SkRect::MakeXYWH(rect_pos.fX + style->padding_l, rect_pos.fY + style->padding_t,
+  //                                       rect_size.fWidth - padding_row, rect_size.fHeight - padding_col),
   //                      paint);
   //   }
   //   canvas->restore();
   // }
 }
 
+auto Node::draw_text_blocks(SkiaRenderer *renderer) -> void {
+  auto &store = *layout_store;
+  auto &blocks = *text_data->blocks;
+  auto &text_measurer = renderer->text_measurer;
+  const auto width = store.text_layout_width[id];
+  const auto pos = store.get_rect_pos(id);
+  const auto clip = renderer->canvas->getLocalClipBounds();
+
+  // - Only the blocks inside the clip are shaped and painted.
+  // - Blocks are placed with the sizes the layout used, a block shaped here resizes the node on the next layout.
+  //   (see `LayoutStore::apply_text_block_sizes`)
+  ++blocks.paint_count;
+  auto is_shaped = false;
+  auto y = pos.fY;
+  for (auto &block : blocks.blocks) {
+    if (y > clip.fBottom) {
+      break;
+    }
+
+    const auto height = text_measurer.measure_block(this, block, width).height;
+    if (y + height >= clip.fTop) {
+      if (block.shaped == nullptr) {
+        text_measurer.shape_block(this, block);
+        is_shaped |= block.is_estimated;
+      }
+      block.shaped->paint(renderer->canvas, pos.fX, y, width, style->color, block.end - block.begin);
+      block.paint_count = blocks.paint_count;
+    }
+    y += height;
+  }
+
+  // drop the blocks that were out of view the longest
+  auto shaped = std::vector<TextBlock *>{};
+  for (auto &block : blocks.blocks) {
+    if (block.shaped != nullptr && block.paint_count != blocks.paint_count) {
+      shaped.push_back(&block);
+    }
+  }
+  if (shaped.size() > TextBlocks::max_shaped_blocks) {
+    const auto drop_count = shaped.size() - TextBlocks::max_shaped_blocks;
+    std::ranges::nth_element(shaped, shaped.begin() + (std::ptrdiff_t)drop_count, {}, &TextBlock::paint_count);
+    for (auto i = std::size_t{}; i < drop_count; ++i) {
+      shaped[i]->shaped = nullptr;
+    }
+  }
+
+  if (is_shaped && !text_data->is_resize_queued) {
+    text_data->is_resize_queued = true;
+    store.resized_text.push_back(this);
+  }
+}
+
+auto Node::draw_grid(SkiaRenderer *renderer) -> void {
+  auto &store = *layout_store;
+  auto &grid = *grid_data;
+  const auto canvas = renderer->canvas;
+  const auto cell_size = grid.cell_size;
+  if (cell_size.fWidth <= 0 || cell_size.fHeight <= 0) {
+    return;
+  }
+
+  const auto font = renderer->text_measurer.make_cell_font(style->font_size);
+  auto font_metrics = SkFontMetrics{};
+  font.getMetrics(&font_metrics);
+  if (grid.font_size != style->font_size) {
+    grid.font_size = style->font_size;
+    for (auto &row : grid.rows) {
+      row.is_damaged = true;
+    }
+  }
+
+  // rebuild a damaged row: one text blob per color and typeface, and one rect per background span
+  // NOTE: Characters the cell font lacks are drawn with a fallback typeface, still one cell wide.
+  auto glyphs = std::vector<SkGlyphID>(grid.col_count);
+  auto faces = std::vector<std::size_t>(grid.col_count);         // (index in `typefaces`)
+  auto typefaces = std::vector<sk_sp<SkTypeface>>{nullptr};      // (the cell font first)
+  auto run_keys = std::vector<std::pair<SkColor, std::size_t>>{}; // Color and face of each run.
+  const auto build_row = [&](std::size_t row_index) {
+    auto &row = grid.rows[row_index];
+    const auto cells = std::span{grid.cells}.subspan(row_index * grid.col_count, grid.col_count);
+    row.runs.clear();
+    row.fills.clear();
+    row.is_damaged = false;
+
+    run_keys.clear();
+    for (auto col = std::size_t{}; col < cells.size(); ++col) {
+      const auto &cell = cells[col];
+      glyphs[col] = cell.ch == ' ' ? SkGlyphID{} : font.unicharToGlyph(cell.ch);
+      faces[col] = 0;
+      if (glyphs[col] == 0 && cell.ch != ' ') {
+        if (const auto typeface = renderer->text_measurer.find_cell_fallback(cell.ch); typeface != nullptr) {
+          glyphs[col] = typeface->unicharToGlyph(cell.ch);
+          faces[col] = (std::size_t)(std::ranges::find(typefaces, typeface) - typefaces.begin());
+          if (faces[col] == typefaces.size()) {
+            typefaces.push_back(typeface);
+          }
+        }
+      }
+      if (glyphs[col] != 0 && std::ranges::find(run_keys, std::pair{cell.fg, faces[col]}) == run_keys.end()) {
+        run_keys.emplace_back(cell.fg, faces[col]);
+      }
+      if (SkColorGetA(cell.bg) != 0) {
+        if (!row.fills.empty() && row.fills.back().color == cell.bg &&
+            row.fills.back().first + row.fills.back().count == col) {
+          ++row.fills.back().count;
+        } else {
+          row.fills.push_back({.color = cell.bg, .first = (std::uint32_t)col, .count = 1});
+        }
+      }
+    }
+
+    for (const auto &[color, face] : run_keys) {
+      const auto is_in_run = [&](std::size_t col) {
+        return glyphs[col] != 0 && cells[col].fg == color && faces[col] == face;
+      };
+      auto count = 0;
+      for (auto col = std::size_t{}; col < cells.size(); ++col) {
+        count += is_in_run(col);
+      }
+      // (on the baseline of the cell font)
+      auto run_font = font;
+      if (face != 0) {
+        run_font.setTypeface(typefaces[face]);
+      }
+      auto builder = SkTextBlobBuilder{};
+      const auto &run = builder.allocRunPosH(run_font, count, -font_metrics.fAscent);
+      auto k = 0;
+      for (auto col = std::size_t{}; col < cells.size(); ++col) {
+        if (is_in_run(col)) {
+          run.glyphs[k] = glyphs[col];
+          run.pos[k] = (float)col * cell_size.fWidth;
+          ++k;
+        }
+      }
+      row.runs.push_back({.color = color, .blob = builder.make()});
+    }
+  };
+
+  // only the rows inside the clip are built and drawn
+  const auto pos = store.get_rect_pos(id);
+  const auto x = pos.fX + style->padding_l;
+  const auto y = pos.fY + style->padding_t;
+  const auto clip = canvas->getLocalClipBounds();
+  const auto row_count = (float)grid.row_count;
+  const auto first = (std::size_t)std::clamp(std::floor((clip.fTop - y) / cell_size.fHeight), 0.f, row_count);
+  const auto last = (std::size_t)std::clamp(std::ceil((clip.fBottom - y) / cell_size.fHeight), 0.f, row_count);
+  for (auto row_index = first; row_index < last; ++row_index) {
+    auto &row = grid.rows[row_index];
+    if (row.is_damaged) {
+      build_row(row_index);
+    }
+
+    const auto row_y = y + (float)row_index * cell_size.fHeight;
+    for (const auto &fill : row.fills) {
+      const auto rect = SkRect::MakeXYWH(x + (float)fill.first * cell_size.fWidth, row_y,
+                                         (float)fill.count * cell_size.fWidth, cell_size.fHeight);
+      canvas->drawRect(rect, SkPaint{SkColor4f::FromColor(fill.color)});
+    }
+    for (const auto &run : row.runs) {
+      auto paint = SkPaint{SkColor4f::FromColor(run.color)};
+      paint.setAntiAlias(true);
+      canvas->drawTextBlob(run.blob, x, row_y, paint);
+    }
+  }
+}
+
 auto Node::draw_all(SkiaRenderer *renderer) -> void {
+  auto &store = *layout_store;
   const auto canvas = renderer->canvas;
   const auto original_count = canvas->getSaveCount();
 
@@ -1233,15 +2059,15 @@ auto Node::draw_all(SkiaRenderer *renderer) -> void {
     canvas->save();
 
     // set clip
-    if (node->parent != nullptr && node->parent->output.style.is_clip_enabled) {
-      canvas->setMatrix(node->parent->output.style.screen_transform);
-      canvas->clipRect(node->parent->output.style.clip_rect, SkClipOp::kIntersect, false);
+    if (node->parent != nullptr && node->parent->style->is_clip_enabled) {
+      canvas->setMatrix(store.screen_transform[node->parent->id]);
+      canvas->clipRect(store.clip_rect[node->parent->id], SkClipOp::kIntersect, false);
     }
 
     node->calculate_screen_transform();
-    canvas->setMatrix(node->output.style.screen_transform);
+    canvas->setMatrix(store.screen_transform[node->id]);
 
-    if (node->output.style.display_mode != DisplayMode::Shown) {
+    if (node->display_mode != DisplayMode::Shown) {
       return Traverse::SkipChildren;
     }
     node->draw(renderer);
@@ -1,6 +1,14 @@
 #pragma once
 
+#include <array>
+#include <chrono>
+#include <deque>
+#include <optional>
 #include <functional>
+#include <memory>
+#include <queue>
+#include <tuple>
+#include <span>
 #include <vector>
 #include <string>
 
@@ -9,10 +17,117 @@
 
 #include "base.hpp"
 #include "node_style.hpp"
+#include "style_sheet.hpp"
+#include "layout_store.hpp"
+#include "text_measurer.hpp"
+#include "thread_pool.hpp"
 #include "renderer.hpp"
 
 namespace rugui {
 
+// Text of a text node and its shaped paragraph. (see `Node::Type::Text`)
+struct TextData {
+  std::string text; // NOTE: Use `Node::set_text()` to modify.
+  std::shared_ptr<SharedParagraph> paragraph; // (shared with the nodes that have the same text and font)
+  std::unique_ptr<SharedParagraph> own_paragraph; // Painted when another node paints `paragraph` differently.
+  std::unique_ptr<TextBlocks> blocks;         // Set instead of `paragraph` for huge text.
+  bool is_paragraph_dirty = true;             // Text or font changed, the paragraph must be reshaped.
+  ParagraphMemo paragraph_memo;
+
+  std::shared_ptr<ShapeJob> shape_job; // Shaping in the background. (see `ShapePolicy::Estimate`)
+  bool is_shape_queued = false;        // In `LayoutStore::shape_queue`.
+  bool is_resize_queued = false;       // In `LayoutStore::resized_text`.
+
+  TextData() = default;
+  TextData(const TextData &) = delete;
+  auto operator=(const TextData &) -> TextData & = delete;
+  ~TextData() {
+    if (shape_job != nullptr) {
+      shape_job->node = nullptr;
+    }
+  }
+};
+
+// A cell of a grid node.
+struct GridCell {
+  SkUnichar ch = ' ';
+  SkColor fg = SK_ColorBLACK;
+  SkColor bg = SK_ColorTRANSPARENT; // (not drawn when transparent)
+
+  auto operator==(const GridCell &) const -> bool = default;
+};
+
+// Glyphs of a grid row with the same color and typeface, drawn as one text blob.
+struct GridRun {
+  SkColor color = SK_ColorBLACK;
+  sk_sp<SkTextBlob> blob;
+};
+
+// Cells of a grid row next to each other with the same background.
+struct GridFill {
+  SkColor color = SK_ColorTRANSPARENT;
+  std::uint32_t first = 0;
+  std::uint32_t count = 0;
+};
+
+// What a grid row draws, built again from its cells when they change.
+struct GridRow {
+  std::vector<GridRun> runs;
+  std::vector<GridFill> fills;
+  bool is_damaged = true; // Cells changed since the row was built. (rows out of view are built once shown)
+};
+
+// Settings of a grid node.
+struct GridOptions {
+  std::size_t rows = 24;
+  std::size_t cols = 80;
+};
+
+// Fixed width cells of a grid node. (see `Node::Type::Grid`)
+struct GridData {
+  std::size_t row_count = 0;
+  std::size_t col_count = 0;
+  std::vector<GridCell> cells; // (row major) NOTE: Use `Node::set_cell()` to modify.
+  std::vector<GridRow> rows;
+  SkSize cell_size = {0, 0}; // (set by the layout)
+  float font_size = 0;       // Font size the rows were built with.
+};
+
+// Items shown by a list node. (see `Node::Type::List`)
+struct ListSource {
+  std::size_t item_count = 0;
+  float item_height = 20;   // Estimated height of a row.
+  std::size_t overscan = 4; // Rows kept past each edge of the viewport.
+  std::function<Node *()> make_row;                  // Create a row, rows are recycled for other items.
+  std::function<void(Node *, std::size_t)> bind_row; // Show the item at the index in the row.
+};
+
+// Settings of a log node, a list that shows one text row per line. (see `Node::append_log`)
+struct LogOptions {
+  std::size_t max_lines = 10000; // Oldest lines are dropped past this.
+  float line_height = 20;        // Estimated height of a line.
+};
+
+// Lines of a log node.
+struct LogLines {
+  std::deque<std::string> lines;
+  std::size_t max_lines = 0;
+  bool is_last_line_open = false; // Last append did not end with a newline.
+  bool is_following_tail = true;  // Scrolled to the bottom, appended lines stay in view.
+  float tail_scroll = 0;          // Scroll pinned to the bottom while following the tail.
+};
+
+// Only the rows in the viewport of a list are its children, between two spacers that stand in for the rest.
+struct ListRows {
+  ListSource source;
+  std::size_t first = 0;         // Item shown by the first row.
+  bool is_rebind_needed = false; // Items changed, every row must be bound again.
+  std::vector<Node *> free_rows; // Rows out of view. (detached)
+  std::unique_ptr<LogLines> log_lines; // NOTE: Only set for log nodes.
+
+  ~ListRows();
+};
+
 struct Node {
 public:
   enum class Traverse {
@@ -24,19 +139,46 @@ public:
   enum class Type {
     Rect,
     Text,
+    List, // Lays out like a `Rect`, children are managed by `list_rows`.
+    Grid, // Rows of monospace cells, without children.
   };
 
   std::string name = "node";
 
   const Type type = Type::Rect;
-  std::string text;
-  std::unique_ptr<skia::textlayout::Paragraph> paragraph;
+
+  // NOTE: Data of the other kinds is kept out of line, so a rect only pays for a pointer per kind.
+  std::unique_ptr<TextData> text_data; // NOTE: Only set for `Type::Text`.
+  std::unique_ptr<ListRows> list_rows; // NOTE: Only set for `Type::List`.
+  std::unique_ptr<GridData> grid_data; // NOTE: Only set for `Type::Grid`.
+
+  std::function<void(Node *)> lazy_build; // Adds the children the first time this node is not collapsed.
+  std::optional<std::chrono::steady_clock::duration> lazy_drop_delay; // Children are dropped after being collapsed this long.
+  std::chrono::steady_clock::time_point collapsed_since;
+  bool is_lazy_built = false;
 
   Node *parent = nullptr;
   std::vector<Node *> children;
 
-  NodeStyle style;
-  UiNodeOutput output;
+  // NOTE: Shared with the nodes of the same class or default style until this node writes to it. (copy on write)
+  //       Call `mark_layout_dirty()` after writing to `edit_style()` directly.
+  const NodeStyle *style = &get_default_style(Type::Rect);
+  std::unique_ptr<NodeStyle> own_style; // (null while `style` is shared)
+  StyleClass *style_class = nullptr;    // Class the style is shared with.
+  std::size_t style_class_index = 0;    // Index in `style_class->nodes`.
+
+  // state of this node, never shared with its style
+  DisplayMode display_mode = DisplayMode::Shown;
+  float vscroll_amount = 0;
+  float hscroll_amount = 0;
+
+  LayoutStore *layout_store = nullptr; // Store of the tree this node is attached to.
+  NodeId id = null_node_id;            // Index of the layout output in `layout_store`.
+
+  bool is_layout_dirty = true;     // Layout of this node or one of its descendants is out of date.
+  bool is_layout_reused = false;   // Output of the last layout was kept as is. (set by `layout_init`)
+  bool is_layout_parallel = false; // Children are laid out on a worker thread. (set by `layout_init`)
+  bool is_layout_cached = false;   // Measured size was taken from `LayoutStore::layout_cache`.
 
   std::function<void(Node *)> on_destroy;
 
@@ -56,35 +198,69 @@ public:
 
 public:
   Node(std::string_view name) : name{name} {}
-  Node(std::string_view name, NodeStyle style) : name{name}, style{style} {}
-  Node(std::string_view name, std::string_view text) : name{name}, type{Type::Text}, text{text} {
-    style.color = SkColors::kBlack;
-    style.width = {SizeMode::FitContent, 0};
-    style.height = {SizeMode::FitContent, 0};
-    style.flex_dir = FlexDir::Row;
-    style.flex_wrap = FlexWrap::Wrap;
+  Node(std::string_view name, NodeStyle style)
+      : name{name}, own_style{std::make_unique<NodeStyle>(style)}, display_mode{style.display_mode} {
+    this->style = own_style.get();
+  }
+  Node(std::string_view name, std::string_view text)
+      : name{name}, type{Type::Text}, text_data{std::make_unique<TextData>()}, style{&get_default_style(Type::Text)} {
+    text_data->text = text;
   }
+  Node(std::string_view name, ListSource source);
+  Node(std::string_view name, LogOptions options);
+  Node(std::string_view name, GridOptions options);
 
   ~Node() {
     if (on_destroy) {
       on_destroy(this);
     }
+    if (style_class != nullptr) {
+      unlink_style_class();
+    }
+    if (layout_store != nullptr) {
+      layout_store->release(id);
+    }
   }
 
-  auto bfs(const std::function<Traverse(Node *)> &fn) -> void;
-  auto dfs(const std::function<Traverse(Node *)> &fn) -> void;
-  auto bfs_with_level(const std::function<Traverse(Node *, int)> &fn) -> void;
-  auto dfs_with_level(const std::function<Traverse(Node *, int)> &fn) -> void;
+  // NOTE: Traversal of an attached node stops when `fn` changes the tree structure.
+  template <typename Fn>
+  auto bfs(Fn &&fn) -> void;
+  template <typename Fn>
+  auto dfs(Fn &&fn) -> void;
+  template <typename Fn>
+  auto bfs_with_level(Fn &&fn) -> void;
+  template <typename Fn>
+  auto dfs_with_level(Fn &&fn) -> void;
+  // `exit` is called after the subtree of a node was visited. (also when `enter` skipped its children)
+  // With `slice`, resumes at `slice->cursor` and returns false when paused at `slice->deadline`.
+  template <typename Enter, typename Exit>
+  auto dfs_with_exit(Enter &&enter, Exit &&exit, SlicedLayout *slice = nullptr) -> bool;
 
   auto tree_str_repr() -> std::string;
 
   auto check_mouse_inside(int mouse_x, int mouse_y) -> bool;
 
+  auto mark_layout_dirty() -> void;
+  auto is_layout_boundary() -> bool;
+
   auto set_parent(Node *parent) -> Node *;
+  auto attach(LayoutStore *store) -> void;
   auto add(Node *node) -> Node *;
   auto delete_all_children() -> void;
 
+  static auto get_default_style(Type type) -> const NodeStyle &;
+  auto edit_style() -> NodeStyle &;
   auto set_style(NodeStyle style) -> Node *;
+  auto set_style_class(StyleClass *style_class) -> Node *;
+  auto apply_style_class(const NodeStyle &style) -> void;
+  auto set_text(std::string_view text) -> Node *;
+  auto set_list_item_count(std::size_t count) -> Node *;
+  auto append_log(std::string_view text) -> Node *;
+  auto set_grid_size(std::size_t rows, std::size_t cols) -> Node *;
+  auto set_cell(std::size_t row, std::size_t col, GridCell cell) -> Node *;
+  auto set_cells(std::size_t row, std::size_t col, std::string_view text, SkColor fg, SkColor bg) -> Node *;
+  auto set_lazy_children(const std::function<void(Node *)> &build,
+                         std::optional<std::chrono::steady_clock::duration> drop_delay = std::nullopt) -> Node *;
 
   auto set_display_mode(DisplayMode mode) -> Node *;
   auto set_local_transform(SkMatrix transform) -> Node *;
@@ -142,12 +318,29 @@ public:
   auto set_on_mouse_click_in(const std::function<bool(Node *, MouseButton, int, int)> &fn) -> Node *;
   auto set_on_mouse_click_out(const std::function<bool(Node *, MouseButton, int, int)> &fn) -> Node *;
 
-  auto layout_pass1() -> std::vector<Node *>;
-  auto layout_pass2(std::span<Node *> reverse_dfs_nodes, SkiaRenderer *renderer) -> void;
-  auto layout_pass3() -> void;
-  auto layout_pass4(std::span<Node *> reverse_dfs_nodes) -> void;
-  auto layout_pass5() -> void;
+  auto mark_paragraph_dirty() -> void;
+  auto shape_paragraph(TextMeasurer *text_measurer, std::size_t worker) -> void;
+  auto layout_paragraph(TextMeasurer *text_measurer, float width) -> ParagraphMetrics;
+  auto draw_text_blocks(SkiaRenderer *renderer) -> void;
+  auto draw_grid(SkiaRenderer *renderer) -> void;
+
+  auto update_list_rows() -> bool;
+  auto update_lazy_children(DisplayMode old_mode) -> void;
+  auto drop_lazy_children(std::chrono::steady_clock::time_point now) -> bool;
+
+  auto layout_init(std::vector<Node *> *parallel_nodes) -> Traverse;
+  auto layout_fit_content(TextMeasurer *text_measurer, std::size_t worker) -> void;
+  auto layout_distribute() -> void;
+  auto layout_flex_lines(TextMeasurer *text_measurer) -> void;
+  auto layout_place_children() -> void;
+  auto layout_measure(TextMeasurer *text_measurer, std::size_t worker, std::vector<Node *> *parallel_nodes,
+                      SlicedLayout *slice = nullptr) -> bool;
+  auto layout_arrange(TextMeasurer *text_measurer, SlicedLayout *slice = nullptr) -> bool;
+  auto layout_resolve_pos(SlicedLayout *slice = nullptr) -> bool;
+  auto layout(TextMeasurer *text_measurer, ThreadPool *thread_pool = nullptr) -> void;
   auto layout(SkiaRenderer *renderer) -> void;
+  auto layout_sliced(TextMeasurer *text_measurer, std::chrono::steady_clock::duration budget) -> bool;
+  auto layout_sliced(SkiaRenderer *renderer, std::chrono::steady_clock::duration budget) -> bool;
 
   auto run_mouse_enter_event(int mouse_x, int mouse_y) -> void;
   auto run_mouse_leave_event(int mouse_x, int mouse_y) -> void;
@@ -162,6 +355,168 @@ public:
 
   auto draw(SkiaRenderer *renderer) -> void;
   auto draw_all(SkiaRenderer *renderer) -> void;
+
+private:
+  auto unlink_style_class() -> void;
+  auto layout_tree(TextMeasurer *text_measurer, ThreadPool *thread_pool) -> void;
+
+  template <typename Fn>
+  auto dfs_detached(Fn &fn, int level) -> bool;
+  template <typename Enter, typename Exit>
+  auto dfs_with_exit_detached(Enter &enter, Exit &exit) -> bool;
 };
 
+template <typename Fn>
+auto Node::bfs(Fn &&fn) -> void {
+  bfs_with_level([&](Node *node, int) -> Traverse { return fn(node); });
+}
+
+template <typename Fn>
+auto Node::dfs(Fn &&fn) -> void {
+  dfs_with_level([&](Node *node, int) -> Traverse { return fn(node); });
+}
+
+template <typename Fn>
+auto Node::bfs_with_level(Fn &&fn) -> void {
+  if (layout_store == nullptr) {
+    auto queue = std::queue<std::tuple<Node *, int>>{};
+    queue.emplace(this, 0);
+    while (!queue.empty()) {
+      auto [node, level] = queue.front();
+      queue.pop();
+      auto result = fn(node, level);
+      if (result == Traverse::Break) {
+        break;
+      }
+      if (result == Traverse::SkipChildren) {
+        continue;
+      }
+      for (auto child : node->children) {
+        queue.emplace(child, level + 1);
+      }
+    }
+    return;
+  }
+
+  auto &store = *layout_store;
+  store.update_order(this);
+
+  // nodes outside of this subtree are filtered by their pre order index
+  const auto first = store.pre_order_index[id];
+  const auto last = store.pre_order_end[first];
+  const auto base_depth = store.level_order_depth[store.level_order_index[id]];
+  for (auto i = std::size_t{store.level_order_index[id]}; i < store.level_order.size(); ++i) {
+    const auto node = store.level_order[i];
+    const auto index = store.pre_order_index[node->id];
+    if (index < first || index >= last) {
+      continue;
+    }
+    if (node != this && store.is_skipped[node->parent->id]) {
+      store.is_skipped[node->id] = true;
+      continue;
+    }
+
+    auto result = fn(node, (int)(store.level_order_depth[i] - base_depth));
+    if (result == Traverse::Break || store.is_order_dirty) {
+      break;
+    }
+    store.is_skipped[node->id] = result == Traverse::SkipChildren;
+  }
+}
+
+template <typename Fn>
+auto Node::dfs_with_level(Fn &&fn) -> void {
+  if (layout_store == nullptr) {
+    dfs_detached(fn, 0);
+    return;
+  }
+
+  auto &store = *layout_store;
+  store.update_order(this);
+
+  const auto first = store.pre_order_index[id];
+  const auto last = store.pre_order_end[first];
+  const auto base_depth = store.pre_order_depth[first];
+  for (auto i = first; i < last;) {
+    auto result = fn(store.pre_order[i], (int)(store.pre_order_depth[i] - base_depth));
+    if (result == Traverse::Break || store.is_order_dirty) {
+      break;
+    }
+    i = result == Traverse::SkipChildren ? store.pre_order_end[i] : i + 1;
+  }
+}
+
+template <typename Enter, typename Exit>
+auto Node::dfs_with_exit(Enter &&enter, Exit &&exit, SlicedLayout *slice) -> bool {
+  if (layout_store == nullptr) {
+    dfs_with_exit_detached(enter, exit);
+    return true;
+  }
+
+  auto &store = *layout_store;
+  store.update_order(this);
+
+  const auto first = store.pre_order_index[id];
+  const auto last = store.pre_order_end[first];
+  auto count = std::uint32_t{};
+  for (auto i = slice != nullptr ? slice->cursor : first; i < last;) {
+    // pause between two nodes (the clock is read every 64 nodes)
+    if (slice != nullptr && ++count % 64 == 0 && std::chrono::steady_clock::now() >= slice->deadline) {
+      slice->cursor = i;
+      return false;
+    }
+
+    const auto node = store.pre_order[i];
+    auto result = enter(node);
+    if (result == Traverse::Break || store.is_order_dirty) {
+      break;
+    }
+    i = result == Traverse::SkipChildren ? store.pre_order_end[i] : i + 1;
+
+    // exit every subtree that ends here (walks up the parents, no stack needed)
+    for (auto node_exit = node; store.pre_order_end[store.pre_order_index[node_exit->id]] == i;
+         node_exit = node_exit->parent) {
+      exit(node_exit);
+      if (node_exit == this) {
+        break;
+      }
+    }
+  }
+  return true;
+}
+
+template <typename Fn>
+auto Node::dfs_detached(Fn &fn, int level) -> bool {
+  auto result = fn(this, level);
+  if (result == Traverse::Break) {
+    return false;
+  }
+  if (result == Traverse::SkipChildren) {
+    return true;
+  }
+  for (auto child : children) {
+    if (!child->dfs_detached(fn, level + 1)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename Enter, typename Exit>
+auto Node::dfs_with_exit_detached(Enter &enter, Exit &exit) -> bool {
+  auto result = enter(this);
+  if (result == Traverse::Break) {
+    return false;
+  }
+  if (result == Traverse::Continue) {
+    for (auto child : children) {
+      if (!child->dfs_with_exit_detached(enter, exit)) {
+        return false;
+      }
+    }
+  }
+  exit(this);
+  return true;
+}
+
 } // namespace rugui
@@ -1,6 +1,4 @@
 #include "node_style.hpp"
-#include "node.hpp"
-#include <iostream>
 
 namespace rugui {
 
@@ -204,225 +202,4 @@ auto NodeStyle::set_flex_self_align(FlexAlign align) -> NodeStyle & {
   return *this;
 }
 
-auto UiNodeOutput::get_rect_pos() -> SkPoint {
-  return {pos.fX + style.margin_l, pos.fY + style.margin_t};
-}
-
-auto UiNodeOutput::get_content_area() -> SkSize {
-  return SkSize{
-    rect_size.fWidth - style.padding_l - style.padding_r,
-    rect_size.fHeight - style.padding_t - style.padding_b,
-  };
-}
-
-auto UiNodeOutput::get_margin_row() -> float {
-  return style.margin_l + style.margin_r;
-}
-
-auto UiNodeOutput::get_margin_col() -> float {
-  return style.margin_t + style.margin_b;
-}
-
-auto UiNodeOutput::get_padding_row() -> float {
-  return style.padding_l + style.padding_r;
-}
-
-auto UiNodeOutput::get_padding_col() -> float {
-  return style.padding_t + style.padding_b;
-}
-
-auto UiNodeOutput::calculate_flex_lines(Node *node) -> void {
-  node->output.flex_lines.emplace_back();
-  auto &content_width = node->output.content_size.fWidth;
-  auto &content_height = node->output.content_size.fHeight;
-
-  switch (node->output.style.flex_wrap) {
-  case FlexWrap::NoWrap: {
-    auto &line = node->output.flex_lines.back();
-    switch (node->type) {
-    case Node::Type::Rect: {
-      line.items = node->children;
-      for (const auto child : node->children) {
-        switch (node->output.style.flex_dir) {
-        case FlexDir::Row:
-          line.width += child->output.layout_size.fWidth;
-          if (line.height < child->output.layout_size.fHeight) {
-            line.height = child->output.layout_size.fHeight;
-          }
-          break;
-        case FlexDir::Col:
-          if (line.width < child->output.layout_size.fWidth) {
-            line.width = child->output.layout_size.fWidth;
-          }
-          line.height += child->output.layout_size.fHeight;
-          break;
-        }
-      }
-
-      content_width = line.width;
-      content_height = line.height;
-
-      if (node->output.style.width.mode == SizeMode::FitContent) {
-        const auto margin_row = node->output.get_margin_row();
-        const auto padding_row = node->output.get_padding_row();
-        node->output.layout_size.fWidth = content_width + margin_row + padding_row;
-        node->output.rect_size.fWidth = content_width + padding_row;
-      }
-      if (node->output.style.height.mode == SizeMode::FitContent) {
-        const auto margin_col = node->output.get_margin_col();
-        const auto padding_col = node->output.get_padding_col();
-        node->output.layout_size.fHeight = content_height + margin_col + padding_col;
-        node->output.rect_size.fHeight = content_height + padding_col;
-      }
-    } break;
-    case Node::Type::Text: {
-      node->paragraph->layout(node->output.get_content_area().fWidth);
-      content_width = node->paragraph->getLongestLine();
-      content_height = node->paragraph->getHeight();
-
-      if (node->output.style.width.mode == SizeMode::FitContent) {
-        const auto margin_row = node->output.get_margin_row();
-        node->output.layout_size.fWidth = content_width + margin_row;
-        node->output.rect_size.fWidth = content_width;
-      }
-      if (node->output.style.height.mode == SizeMode::FitContent) {
-        const auto margin_col = node->output.get_margin_col();
-        node->output.layout_size.fHeight = content_height + margin_col;
-        node->output.rect_size.fHeight = content_height;
-      }
-
-      line.width = node->output.layout_size.fWidth;
-      line.height = node->output.layout_size.fHeight;
-    } break;
-    }
-  } break;
-  case FlexWrap::Wrap: {
-    switch (node->type) {
-    case Node::Type::Rect: {
-      content_width = 0.f;
-      content_height = 0.f;
-
-      auto line_width = 0.f;
-      auto line_height = 0.f;
-      auto line_start = std::size_t{};
-      auto is_overflowed = false;
-
-      for (auto i = std::size_t{}; i < node->children.size(); ++i) {
-        const auto &child = node->children[i];
-        auto &line = node->output.flex_lines.back();
-
-        // check overflow
-        switch (node->output.style.flex_dir) {
-        case FlexDir::Row:
-          if (line_width + child->output.layout_size.fWidth > node->output.get_content_area().fWidth) {
-            is_overflowed = true;
-          }
-          break;
-        case FlexDir::Col:
-          if (line_height + child->output.layout_size.fHeight > node->output.get_content_area().fHeight) {
-            is_overflowed = true;
-          }
-          break;
-        }
-
-        if (is_overflowed) {
-          is_overflowed = false;
-          line.items = std::span{node->children.data() + line_start, node->children.data() + i};
-
-          switch (node->output.style.flex_dir) {
-          case FlexDir::Row:
-            if (content_width < line_width) {
-              content_width = line_width;
-            }
-            content_height += line_height;
-            line.width = line_width;
-            line.height = line_height;
-            break;
-          case FlexDir::Col:
-            content_width += line_width;
-            if (content_height < line_height) {
-              content_height = line_height;
-            }
-            line.width = line_width;
-            line.height = line_height;
-            break;
-          }
-
-          line_width = 0;
-          line_height = 0;
-          line_start = i;
-          node->output.flex_lines.emplace_back();
-        }
-
-        switch (node->output.style.flex_dir) {
-        case FlexDir::Row:
-          line_width += child->output.layout_size.fWidth;
-          if (line_height < child->output.layout_size.fHeight) {
-            line_height = child->output.layout_size.fHeight;
-          }
-          break;
-        case FlexDir::Col:
-          if (line_width < child->output.layout_size.fWidth) {
-            line_width = child->output.layout_size.fWidth;
-          }
-          line_height += child->output.layout_size.fHeight;
-          break;
-        }
-
-        if (i == node->children.size() - 1) {
-          if (!node->output.flex_lines.back().items.empty()) {
-            node->output.flex_lines.emplace_back();
-          }
-          auto &line = node->output.flex_lines.back();
-          line.items = std::span{node->children.data() + line_start, node->children.data() + node->children.size()};
-
-          switch (node->output.style.flex_dir) {
-          case FlexDir::Row:
-            if (content_width < line_width) {
-              content_width = line_width;
-            }
-            content_height += line_height;
-            line.width = line_width;
-            line.height = line_height;
-            break;
-          case FlexDir::Col:
-            content_width += line_width;
-            if (content_height < line_height) {
-              content_height = line_height;
-            }
-            line.width = line_width;
-            line.height = line_height;
-            break;
-          }
-        }
-      }
-    } break;
-    case Node::Type::Text: {
-      auto content_area_width = node->output.get_content_area().fWidth;
-      if (node->parent->output.style.width.mode == SizeMode::FitContent) {
-        content_area_width = node->parent->output.max_content_area.fWidth - node->output.get_margin_row();
-      }
-
-      if (content_width > content_area_width) {
-        node->paragraph->layout(content_area_width);
-        content_width = node->paragraph->getLongestLine();
-        content_height = node->paragraph->getHeight();
-      }
-
-      if (node->output.style.width.mode == SizeMode::FitContent) {
-        const auto margin_row = node->output.get_margin_row();
-        node->output.layout_size.fWidth = content_width + margin_row;
-        node->output.rect_size.fWidth = content_width;
-      }
-      if (node->output.style.height.mode == SizeMode::FitContent) {
-        const auto margin_col = node->output.get_margin_col();
-        node->output.layout_size.fHeight = content_height + margin_col;
-        node->output.rect_size.fHeight = content_height;
-      }
-    } break;
-    }
-  } break;
-  }
-}
-
 } // namespace rugui
@@ -1,8 +1,5 @@
 #pragma once
 
-#include <span>
-#include <vector>
-
 #include <include/core/SkPoint.h>
 #include <include/core/SkSize.h>
 #include <include/core/SkMatrix.h>
@@ -64,11 +61,10 @@ enum class FlexAlign {
 };
 
 struct NodeStyle {
-  DisplayMode display_mode = DisplayMode::Shown;
+  DisplayMode display_mode = DisplayMode::Shown; // Given to the node by `Node::set_style`. (see `Node::display_mode`)
 
   TransformMode transform_mode = TransformMode::Local;
   SkMatrix transform = SkMatrix::I();
-  SkMatrix screen_transform = SkMatrix::I();
 
   SkColor4f color = SkColors::kTransparent;
 
@@ -79,11 +75,8 @@ struct NodeStyle {
 
   bool is_vscroll_enabled = true;
   bool is_hscroll_enabled = true;
-  float vscroll_amount = 0;
-  float hscroll_amount = 0;
 
   bool is_clip_enabled = true;
-  SkRect clip_rect = SkRect::MakeEmpty(); // (screen space)
 
   Size width;
   Size height;
@@ -154,35 +147,4 @@ struct NodeStyle {
   auto set_flex_self_align(FlexAlign align) -> NodeStyle &;
 };
 
-struct FlexLine {
-  float width = 0;
-  float height = 0;
-  std::span<struct Node *> items;
-};
-
-struct UiNodeOutput {
-  NodeStyle style;
-  SkPoint pos = {0, 0};
-  SkSize rect_size = {0, 0};
-  SkSize layout_size = {0, 0};
-  SkSize content_size = {0, 0};
-  SkSize content_overflow = {0, 0};
-  SkSize max_content_area = {0, 0};
-  std::vector<FlexLine> flex_lines;
-
-  UiNodeOutput() = default;
-  explicit UiNodeOutput(NodeStyle style) : style{style} {}
-
-  auto get_rect_pos() -> SkPoint;
-  auto get_content_area() -> SkSize;
-
-  auto get_margin_row() -> float;
-  auto get_margin_col() -> float;
-
-  auto get_padding_row() -> float;
-  auto get_padding_col() -> float;
-
-  auto calculate_flex_lines(Node *node) -> void;
-};
-
 } // namespace rugui
@@ -1,5 +1,6 @@
 #include "renderer.hpp"
 
+#include <algorithm>
 #include <iostream>
 
 #include <glad/glad.h>
@@ -19,12 +20,23 @@ auto SkiaRenderer::init(Screen *screen) -> void {
   }
   canvas = surface->getCanvas();
 
-  font_mgr = SkFontMgr_New_DirectWrite();
+  font_mgr = make_font_mgr(font_options);
   if (font_mgr == nullptr) {
     return;
   }
-  font_collection = sk_sp{new skia::textlayout::FontCollection{}};
-  font_collection->setDefaultFontManager(font_mgr);
+
+  init_layout_workers(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+
+  // (while the tree is built)
+  if (!warm_up_texts.empty()) {
+    text_measurer.warm_up(warm_up_texts);
+  }
+}
+
+auto SkiaRenderer::init_layout_workers(std::size_t thread_count) -> void {
+  layout_thread_pool.start(thread_count);
+  text_measurer.init(font_mgr, layout_thread_pool.get_worker_count());
+  font_collection = text_measurer.font_collections.front();
 }
 
 auto SkiaRenderer::new_context() -> sk_sp<GrDirectContext> {
@@ -2,7 +2,6 @@
 
 #include <include/core/SkColorSpace.h>
 #include <include/core/SkCanvas.h>
-#include <include/ports/SkTypeface_win.h>
 #include <include/gpu/ganesh/GrDirectContext.h>
 #include <include/gpu/ganesh/GrBackendSurface.h>
 #include <include/gpu/ganesh/gl/GrGLAssembleInterface.h>
@@ -12,7 +11,10 @@
 #include <modules/skparagraph/include/FontCollection.h>
 #include <modules/skparagraph/include/ParagraphBuilder.h>
 
+#include "font_manager.hpp"
 #include "screen.hpp"
+#include "text_measurer.hpp"
+#include "thread_pool.hpp"
 
 namespace rugui {
 
@@ -24,12 +26,18 @@ struct SkiaRenderer {
   sk_sp<GrDirectContext> context = nullptr;
   sk_sp<SkSurface> surface = nullptr;
   SkCanvas *canvas = nullptr;
+  FontOptions font_options;              // (read by `init`)
+  std::vector<WarmUpText> warm_up_texts; // Warmed up in the background by `init`.
   sk_sp<SkFontMgr> font_mgr = nullptr;
   sk_sp<skia::textlayout::FontCollection> font_collection = nullptr;
 
+  FontCollectionTextMeasurer text_measurer;
+  ThreadPool layout_thread_pool;
+
   bool show_debug_lines = false;
 
   auto init(Screen *screen) -> void;
+  auto init_layout_workers(std::size_t thread_count) -> void;
   auto new_context() -> sk_sp<GrDirectContext>;
   auto new_surface(Screen *screen) -> sk_sp<SkSurface>;
   auto regenerate_surface(Screen *screen) -> void;
@@ -0,0 +1,89 @@
+#pragma once
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define RUGUI_SIMD_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define RUGUI_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+#include <bit>
+#include <cstddef>
+#include <span>
+
+#include <include/core/SkSize.h>
+
+namespace rugui {
+
+// NOTE: Sizes are read as packed (width, height) float pairs.
+static_assert(sizeof(SkSize) == sizeof(float) * 2);
+
+// Largest width and height of the sizes, starting from 0.
+// Same as `if (max < size) max = size;` for each axis, so a NaN size is skipped.
+// NOTE: Only max is computed in parallel lanes, it does not depend on the order. (unlike addition)
+inline auto max_sizes(std::span<const SkSize> sizes) -> SkSize {
+  const auto *values = (const float *)sizes.data();
+  auto i = std::size_t{};
+  auto max = SkSize{0, 0};
+
+#if defined(RUGUI_SIMD_SSE2)
+  // two sizes per register: (w, h, w, h)
+  auto acc = _mm_setzero_ps();
+  for (; i + 2 <= sizes.size(); i += 2) {
+    acc = _mm_max_ps(_mm_loadu_ps(values + i * 2), acc); // (`acc` is kept when the size is not greater)
+  }
+  acc = _mm_max_ps(_mm_movehl_ps(acc, acc), acc);
+  _mm_store_sd((double *)&max, _mm_castps_pd(acc));
+#elif defined(RUGUI_SIMD_NEON)
+  auto acc = vdupq_n_f32(0);
+  for (; i + 2 <= sizes.size(); i += 2) {
+    const auto v = vld1q_f32(values + i * 2);
+    acc = vbslq_f32(vcgtq_f32(v, acc), v, acc); // (`vmaxq_f32` would return NaN)
+  }
+  const auto lo = vget_low_f32(acc);
+  const auto hi = vget_high_f32(acc);
+  vst1_f32(&max.fWidth, vbsl_f32(vcgt_f32(hi, lo), hi, lo));
+#endif
+
+  for (; i < sizes.size(); ++i) {
+    if (max.fWidth < values[i * 2]) {
+      max.fWidth = values[i * 2];
+    }
+    if (max.fHeight < values[i * 2 + 1]) {
+      max.fHeight = values[i * 2 + 1];
+    }
+  }
+  return max;
+}
+
+// Index of the first value greater than `limit`, or `values.size()`. (NaN is never greater)
+inline auto find_greater(std::span<const float> values, float limit) -> std::size_t {
+  auto i = std::size_t{};
+
+#if defined(RUGUI_SIMD_SSE2)
+  const auto limits = _mm_set1_ps(limit);
+  for (; i + 4 <= values.size(); i += 4) {
+    const auto mask = _mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(values.data() + i), limits));
+    if (mask != 0) {
+      return i + (std::size_t)std::countr_zero((unsigned)mask);
+    }
+  }
+#elif defined(RUGUI_SIMD_NEON)
+  const auto limits = vdupq_n_f32(limit);
+  for (; i + 4 <= values.size(); i += 4) {
+    if (vmaxvq_u32(vcgtq_f32(vld1q_f32(values.data() + i), limits)) != 0) {
+      break; // (found by the scalar loop below)
+    }
+  }
+#endif
+
+  for (; i < values.size(); ++i) {
+    if (values[i] > limit) {
+      return i;
+    }
+  }
+  return values.size();
+}
+
+} // namespace rugui
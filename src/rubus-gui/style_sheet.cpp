@@ -0,0 +1,29 @@
+#include "style_sheet.hpp"
+#include "node.hpp"
+
+namespace rugui {
+
+auto StyleSheet::add(std::string_view name, const NodeStyle &style) -> StyleClass * {
+  auto &style_class = classes.emplace_back();
+  style_class.name = name;
+  style_class.style = style;
+  return &style_class;
+}
+
+auto StyleSheet::find(std::string_view name) -> StyleClass * {
+  for (auto &style_class : classes) {
+    if (style_class.name == name) {
+      return &style_class;
+    }
+  }
+  return nullptr;
+}
+
+auto StyleSheet::set(StyleClass *style_class, const NodeStyle &style) -> void {
+  for (const auto node : style_class->nodes) {
+    node->apply_style_class(style);
+  }
+  style_class->style = style;
+}
+
+} // namespace rugui
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "node_style.hpp"
+
+namespace rugui {
+
+struct Node;
+
+// Style defined once for many nodes.
+struct StyleClass {
+  std::string name;
+  NodeStyle style;
+  std::vector<Node *> nodes; // Nodes using this class. (see `Node::set_style_class`)
+};
+
+// Named style classes.
+// NOTE: Must outlive the nodes using its classes.
+struct StyleSheet {
+  std::deque<StyleClass> classes; // (a deque never moves the classes)
+
+  auto add(std::string_view name, const NodeStyle &style) -> StyleClass *;
+  auto find(std::string_view name) -> StyleClass *;
+
+  // Restyle every node of the class.
+  auto set(StyleClass *style_class, const NodeStyle &style) -> void;
+};
+
+} // namespace rugui
@@ -0,0 +1,885 @@
+#include "text_measurer.hpp"
+#include "node.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include <include/core/SkCanvas.h>
+#include <include/core/SkImageInfo.h>
+#include <include/core/SkSurface.h>
+#include <modules/skparagraph/include/ParagraphBuilder.h>
+
+namespace rugui {
+
+auto ParagraphMemo::find(float width) -> const ParagraphMetrics * {
+  for (auto i = std::size_t{}; i < size; ++i) {
+    if (entries[i].width == width) {
+      return &entries[i];
+    }
+  }
+  return nullptr;
+}
+
+auto ParagraphMemo::insert(const ParagraphMetrics &metrics) -> void {
+  // replace the oldest entry when full
+  entries[next] = metrics;
+  next = (next + 1) % capacity;
+  size = std::min(size + 1, capacity);
+}
+
+auto ParagraphMemo::clear() -> void {
+  size = 0;
+  next = 0;
+}
+
+auto SimpleText::layout(float width) -> ParagraphMetrics {
+  auto metrics = ParagraphMetrics{.width = width};
+
+  // - Lines break at spaces, a word wider than the line gets a line of its own.
+  // - The spaces where a line breaks are dropped.
+  lines.clear();
+  blob = nullptr;
+
+  const auto count = (std::uint32_t)text.length();
+  auto line = Line{};
+  auto word_end = std::uint32_t{};
+  while (true) {
+    auto word_begin = word_end;
+    while (word_begin < count && text[word_begin] == ' ') {
+      ++word_begin;
+    }
+    if (word_begin == count) {
+      break;
+    }
+    word_end = word_begin;
+    while (word_end < count && text[word_end] != ' ') {
+      ++word_end;
+    }
+
+    metrics.min_intrinsic_width = std::max(metrics.min_intrinsic_width, offsets[word_end] - offsets[word_begin]);
+    if (line.end > line.begin && offsets[word_end] - offsets[line.begin] > width) {
+      lines.push_back(line);
+      line.begin = word_begin;
+    }
+    line.end = word_end;
+  }
+  lines.push_back(line);
+
+  for (const auto &line : lines) {
+    metrics.longest_line = std::max(metrics.longest_line, offsets[line.end] - offsets[line.begin]);
+  }
+  metrics.height = (float)lines.size() * line_height;
+  metrics.max_intrinsic_width = offsets[word_end] - offsets[0];
+  return metrics;
+}
+
+auto SimpleText::paint(SkCanvas *canvas, float x, float y, SkColor4f color) -> void {
+  if (blob == nullptr) {
+    auto builder = SkTextBlobBuilder{};
+    for (auto i = std::size_t{}; i < lines.size(); ++i) {
+      const auto &line = lines[i];
+      const auto count = (int)(line.end - line.begin);
+      if (count == 0) {
+        continue;
+      }
+      const auto &run = builder.allocRunPosH(font, count, (float)i * line_height - ascent);
+      for (auto k = 0; k < count; ++k) {
+        run.glyphs[k] = glyphs[line.begin + k];
+        run.pos[k] = offsets[line.begin + k] - offsets[line.begin];
+      }
+    }
+    blob = builder.make();
+  }
+
+  // (null when there is nothing to draw)
+  if (blob != nullptr) {
+    auto paint = SkPaint{color};
+    paint.setAntiAlias(true);
+    canvas->drawTextBlob(blob, x, y, paint);
+  }
+}
+
+auto make_text_blocks(std::string_view text) -> std::unique_ptr<TextBlocks> {
+  if (text.length() < TextBlocks::min_text_length || text.length() > std::numeric_limits<std::uint32_t>::max()) {
+    return nullptr;
+  }
+
+  // - Split at the first line break past each block length. (the line break itself is dropped)
+  // - A line running past the max block length is split at its last space before it, or else between two code
+  //   points. (each block starts a new line)
+  auto blocks = std::make_unique<TextBlocks>();
+  auto begin = std::size_t{};
+  while (begin + TextBlocks::block_length < text.length()) {
+    const auto max_end = std::min(begin + TextBlocks::max_block_length, text.length());
+    auto end = text.substr(0, max_end).find('\n', begin + TextBlocks::block_length);
+    auto next = end;
+    if (end != std::string_view::npos) {
+      next = end + 1;
+    } else if (max_end == text.length()) {
+      break;
+    } else {
+      end = text.rfind(' ', max_end - 1);
+      if (end != std::string_view::npos && end >= begin + TextBlocks::block_length) {
+        end += 1; // (the space ends the block)
+      } else {
+        end = max_end;
+        while (end > begin + TextBlocks::block_length && ((unsigned char)text[end] & 0xc0) == 0x80) {
+          --end;
+        }
+      }
+      next = end;
+    }
+
+    auto &block = blocks->blocks.emplace_back();
+    block.begin = (std::uint32_t)begin;
+    block.end = (std::uint32_t)end;
+    begin = next;
+  }
+  auto &block = blocks->blocks.emplace_back();
+  block.begin = (std::uint32_t)begin;
+  block.end = (std::uint32_t)text.length();
+  return blocks;
+}
+
+auto next_utf8(std::string_view text, std::size_t &i) -> SkUnichar {
+  constexpr auto invalid = SkUnichar{0xfffd};
+  const auto lead = (unsigned char)text[i++];
+  if (lead < 0x80) {
+    return lead;
+  }
+  const auto length = lead >= 0xf0 ? 3 : lead >= 0xe0 ? 2 : lead >= 0xc0 ? 1 : 0;
+  if (length == 0 || lead > 0xf4) {
+    return invalid;
+  }
+
+  auto code_point = (SkUnichar)(lead & (0x3f >> length));
+  for (auto k = 0; k < length; ++k) {
+    if (i == text.length() || ((unsigned char)text[i] & 0xc0) != 0x80) {
+      return invalid;
+    }
+    code_point = code_point << 6 | ((unsigned char)text[i++] & 0x3f);
+  }
+  return code_point;
+}
+
+auto is_simple_text(std::string_view text) -> bool {
+  // printable ascii only: one glyph per byte, no bidi, no line breaks
+  return std::ranges::all_of(text, [](char c) { return c >= 0x20 && c <= 0x7e; });
+}
+
+auto make_simple_text(std::string_view text, float font_size, const sk_sp<SkTypeface> &typeface)
+  -> std::unique_ptr<SimpleText> {
+  if (typeface == nullptr || text.length() > std::numeric_limits<std::uint32_t>::max()) {
+    return nullptr;
+  }
+
+  if (!is_simple_text(text)) {
+    return nullptr;
+  }
+
+  auto simple_text = std::make_unique<SimpleText>();
+  simple_text->text = text;
+  simple_text->font = SkFont{typeface, font_size};
+  simple_text->font.setSubpixel(true);
+  simple_text->font.setEdging(SkFont::Edging::kAntiAlias);
+
+  // a glyph missing from the typeface needs a fallback font
+  simple_text->glyphs.resize(text.length());
+  simple_text->font.textToGlyphs(text.data(), text.length(), SkTextEncoding::kUTF8, simple_text->glyphs.data(),
+                                 (int)text.length());
+  if (std::ranges::find(simple_text->glyphs, SkGlyphID{0}) != simple_text->glyphs.end()) {
+    return nullptr;
+  }
+
+  auto advances = std::vector<float>(text.length());
+  simple_text->font.getWidths(simple_text->glyphs.data(), (int)text.length(), advances.data());
+  simple_text->offsets.resize(text.length() + 1);
+  for (auto i = std::size_t{}; i < text.length(); ++i) {
+    simple_text->offsets[i + 1] = simple_text->offsets[i] + advances[i];
+  }
+
+  auto font_metrics = SkFontMetrics{};
+  simple_text->font.getMetrics(&font_metrics);
+  simple_text->ascent = font_metrics.fAscent;
+  simple_text->line_height = font_metrics.fDescent - font_metrics.fAscent + font_metrics.fLeading;
+  return simple_text;
+}
+
+auto SharedParagraph::is_built() const -> bool {
+  return paragraph != nullptr || simple_text != nullptr;
+}
+
+auto SharedParagraph::is_painted_as(float width, SkColor4f color) const -> bool {
+  // (simple text takes the color when painted)
+  return this->width == width && (simple_text != nullptr || this->color == color);
+}
+
+auto SharedParagraph::paint(SkCanvas *canvas, float x, float y, float width, SkColor4f color,
+                            std::size_t text_length) -> void {
+  // NOTE: Not locked, painting never overlaps the layout.
+  if (simple_text != nullptr) {
+    // (takes the color when painted)
+    if (this->width != width) {
+      layout(width);
+    }
+    simple_text->paint(canvas, x, y, color);
+    return;
+  }
+
+  // the memo may have answered the layout without breaking the lines (or another node broke them)
+  auto needs_layout = this->width != width;
+
+  if (this->color != color) {
+    auto paint = SkPaint{color};
+    paint.setAntiAlias(true);
+
+    // Recolor without reshaping: the shaped runs are kept in the paragraph cache of the font collection,
+    // only the lines are rebuilt so they pick up the new paint.
+    paragraph->updateForegroundPaint(0, text_length, paint);
+    paragraph->markDirty();
+    this->color = color;
+    needs_layout = true;
+  }
+
+  if (needs_layout) {
+    layout(width);
+  }
+  paragraph->paint(canvas, x, y);
+}
+
+auto SharedParagraph::layout(float width) -> ParagraphMetrics {
+  this->width = width;
+  if (simple_text != nullptr) {
+    return simple_text->layout(width);
+  }
+
+  paragraph->layout(width);
+  return ParagraphMetrics{
+    .width = width,
+    .longest_line = paragraph->getLongestLine(),
+    .height = paragraph->getHeight(),
+    .min_intrinsic_width = paragraph->getMinIntrinsicWidth(),
+    .max_intrinsic_width = paragraph->getMaxIntrinsicWidth(),
+  };
+}
+
+auto make_paragraph(std::string_view text, float font_size, SkColor4f color,
+                    const sk_sp<skia::textlayout::FontCollection> &font_collection)
+  -> std::unique_ptr<skia::textlayout::Paragraph> {
+  auto paint = SkPaint{color};
+  paint.setAntiAlias(true);
+
+  auto text_style = skia::textlayout::TextStyle{};
+  text_style.setFontSize(font_size);
+  text_style.setForegroundPaint(paint);
+
+  auto builder = skia::textlayout::ParagraphBuilder::make(skia::textlayout::ParagraphStyle{}, font_collection);
+  builder->pushStyle(text_style);
+  builder->addText(text.data(), text.length());
+  return builder->Build();
+}
+
+BackgroundShaper::~BackgroundShaper() {
+  stop();
+}
+
+auto BackgroundShaper::start(sk_sp<SkFontMgr> font_mgr, std::size_t thread_count) -> void {
+  stop();
+
+  is_stopping = false;
+  for (auto i = std::size_t{}; i < thread_count; ++i) {
+    threads.emplace_back([this, font_mgr] {
+      auto font_collection = sk_sp{new skia::textlayout::FontCollection{}};
+      font_collection->setDefaultFontManager(font_mgr);
+
+      while (true) {
+        auto job = std::shared_ptr<ShapeJob>{};
+        {
+          auto lock = std::unique_lock{mutex};
+          work_cv.wait(lock, [&] { return is_stopping || !queue.empty(); });
+          if (is_stopping) {
+            return;
+          }
+          job = std::move(queue.front());
+          queue.pop_front();
+        }
+
+        job->paragraph = make_paragraph(job->text, job->font_size, job->color, font_collection);
+        job->paragraph->layout(std::numeric_limits<float>::infinity());
+        job->metrics = ParagraphMetrics{
+          .width = std::numeric_limits<float>::infinity(),
+          .longest_line = job->paragraph->getLongestLine(),
+          .height = job->paragraph->getHeight(),
+          .min_intrinsic_width = job->paragraph->getMinIntrinsicWidth(),
+          .max_intrinsic_width = job->paragraph->getMaxIntrinsicWidth(),
+        };
+        job->is_done = true;
+      }
+    });
+  }
+}
+
+auto BackgroundShaper::stop() -> void {
+  {
+    auto lock = std::scoped_lock{mutex};
+    is_stopping = true;
+    queue.clear();
+  }
+  work_cv.notify_all();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  threads.clear();
+}
+
+auto BackgroundShaper::is_started() -> bool {
+  return !threads.empty();
+}
+
+auto BackgroundShaper::submit(std::shared_ptr<ShapeJob> job) -> void {
+  {
+    auto lock = std::scoped_lock{mutex};
+    jobs.push_back(job);
+    queue.push_back(std::move(job));
+  }
+  work_cv.notify_one();
+}
+
+auto BackgroundShaper::take_done() -> std::vector<std::shared_ptr<ShapeJob>> {
+  auto lock = std::scoped_lock{mutex};
+  auto done = std::vector<std::shared_ptr<ShapeJob>>{};
+  std::erase_if(jobs, [&](const std::shared_ptr<ShapeJob> &job) {
+    if (!job->is_done) {
+      return false;
+    }
+    done.push_back(job);
+    return true;
+  });
+  return done;
+}
+
+auto BackgroundShaper::take_all() -> std::vector<std::shared_ptr<ShapeJob>> {
+  auto lock = std::scoped_lock{mutex};
+  return std::exchange(jobs, {});
+}
+
+auto ShapeCache::KeyHash::operator()(const Key &key) const -> std::size_t {
+  return std::hash<std::string_view>{}(key.text) ^ (std::hash<float>{}(key.font_size) * 31);
+}
+
+auto ShapeCache::get_entry(std::string_view text, float font_size) -> std::shared_ptr<SharedParagraph> {
+  auto lock = std::scoped_lock{mutex};
+
+  auto key = Key{.text = std::string{text}, .font_size = font_size};
+  if (const auto it = index.find(key); it != index.end()) {
+    entries.splice(entries.begin(), entries, it->second);
+    return it->second->paragraph;
+  }
+
+  // the paragraph is built by the caller (outside of the cache lock)
+  entries.push_front(Entry{.key = key, .paragraph = std::make_shared<SharedParagraph>(), .bytes = 0});
+  entries.front().bytes = sizeof(Entry) + sizeof(SharedParagraph) + text.length() * bytes_per_char;
+  bytes += entries.front().bytes;
+  index.emplace(std::move(key), entries.begin());
+
+  // evict the least recently used (keeps the new entry)
+  while (bytes > byte_budget && entries.size() > 1) {
+    bytes -= entries.back().bytes;
+    index.erase(entries.back().key);
+    entries.pop_back();
+  }
+  return entries.front().paragraph;
+}
+
+auto ShapeCache::get(std::string_view text, float font_size, const std::function<void(SharedParagraph &)> &build)
+  -> std::shared_ptr<SharedParagraph> {
+  auto shared = get_entry(text, font_size);
+  auto lock = std::scoped_lock{shared->mutex};
+  if (!shared->is_built()) {
+    build(*shared);
+  }
+  return shared;
+}
+
+auto ShapeCache::insert(std::string_view text, float font_size, SkColor4f color,
+                        std::unique_ptr<skia::textlayout::Paragraph> paragraph) -> std::shared_ptr<SharedParagraph> {
+  return get(text, font_size, [&](SharedParagraph &shared) {
+    shared.paragraph = std::move(paragraph);
+    shared.color = color;
+  });
+}
+
+auto ShapeCache::find(std::string_view text, float font_size) -> std::shared_ptr<SharedParagraph> {
+  auto shared = std::shared_ptr<SharedParagraph>{};
+  {
+    auto lock = std::scoped_lock{mutex};
+    const auto it = index.find(Key{.text = std::string{text}, .font_size = font_size});
+    if (it == index.end()) {
+      return nullptr;
+    }
+    entries.splice(entries.begin(), entries, it->second);
+    shared = it->second->paragraph;
+  }
+
+  auto lock = std::scoped_lock{shared->mutex};
+  return shared->is_built() ? shared : nullptr;
+}
+
+auto ShapeCache::get_byte_count() -> std::size_t {
+  auto lock = std::scoped_lock{mutex};
+  return bytes;
+}
+
+auto ShapeCache::clear() -> void {
+  auto lock = std::scoped_lock{mutex};
+  entries.clear();
+  index.clear();
+  bytes = 0;
+}
+
+auto TextMeasurer::shape_all(std::span<Node *const> nodes, ThreadPool *thread_pool) -> void {
+  const auto shape_node = [&](std::size_t index, std::size_t worker) { nodes[index]->shape_paragraph(this, worker); };
+  if (thread_pool != nullptr) {
+    thread_pool->run(nodes.size(), shape_node);
+  } else {
+    for (auto i = std::size_t{}; i < nodes.size(); ++i) {
+      shape_node(i, 0);
+    }
+  }
+}
+
+TextWarmer::~TextWarmer() {
+  stop();
+}
+
+auto TextWarmer::start(FontCollectionTextMeasurer *text_measurer) -> void {
+  stop();
+
+  is_stopping = false;
+  thread = std::thread{[this, text_measurer] {
+    auto font_collection = sk_sp{new skia::textlayout::FontCollection{}};
+    font_collection->setDefaultFontManager(text_measurer->font_mgr);
+
+    // (the glyphs are rasterized into the glyph cache shared by every canvas)
+    const auto surface = SkSurfaces::Raster(SkImageInfo::MakeN32Premul(512, 512));
+    if (surface == nullptr) {
+      auto lock = std::scoped_lock{mutex};
+      is_stopping = true;
+      idle_cv.notify_all();
+      return;
+    }
+
+    while (true) {
+      auto text = WarmUpText{};
+      {
+        auto lock = std::unique_lock{mutex};
+        is_busy = false;
+        idle_cv.notify_all();
+        work_cv.wait(lock, [&] { return is_stopping || !queue.empty(); });
+        if (is_stopping) {
+          return;
+        }
+        text = std::move(queue.front());
+        queue.pop_front();
+        is_busy = true;
+      }
+      text_measurer->warm_up_text(font_collection, surface->getCanvas(), text);
+    }
+  }};
+}
+
+auto TextWarmer::stop() -> void {
+  {
+    auto lock = std::scoped_lock{mutex};
+    is_stopping = true;
+    queue.clear();
+  }
+  work_cv.notify_all();
+  if (thread.joinable()) {
+    thread.join();
+  }
+  is_busy = false;
+  idle_cv.notify_all();
+}
+
+auto TextWarmer::is_started() -> bool {
+  return thread.joinable();
+}
+
+auto TextWarmer::submit(std::span<const WarmUpText> texts) -> void {
+  {
+    auto lock = std::scoped_lock{mutex};
+    queue.insert(queue.end(), texts.begin(), texts.end());
+  }
+  work_cv.notify_one();
+}
+
+auto TextWarmer::wait() -> void {
+  auto lock = std::unique_lock{mutex};
+  idle_cv.wait(lock, [&] { return !thread.joinable() || is_stopping || (queue.empty() && !is_busy); });
+}
+
+auto FontCollectionTextMeasurer::init(sk_sp<SkFontMgr> font_mgr, std::size_t worker_count) -> void {
+  text_warmer.stop();
+  this->font_mgr = font_mgr;
+  font_collections.clear();
+  for (auto i = std::size_t{}; i < std::max(worker_count, std::size_t{1}); ++i) {
+    auto collection = sk_sp{new skia::textlayout::FontCollection{}};
+    collection->setDefaultFontManager(font_mgr);
+    font_collections.push_back(collection);
+  }
+
+  // same lookup as a paragraph with the default text style
+  default_typeface = nullptr;
+  if (const auto typefaces = font_collections.front()->findTypefaces({SkString{"sans-serif"}}, SkFontStyle{});
+      !typefaces.empty()) {
+    default_typeface = typefaces.front();
+  }
+  if (default_typeface == nullptr) {
+    default_typeface = font_collections.front()->defaultFallback();
+  }
+  if (default_typeface == nullptr && font_mgr != nullptr) {
+    default_typeface = font_mgr->legacyMakeTypeface(nullptr, SkFontStyle{});
+  }
+
+  monospace_typeface = nullptr;
+  cell_fallbacks.clear();
+  if (const auto typefaces = font_collections.front()->findTypefaces({SkString{"monospace"}}, SkFontStyle{});
+      !typefaces.empty()) {
+    monospace_typeface = typefaces.front();
+  }
+  if (monospace_typeface == nullptr) {
+    monospace_typeface = default_typeface;
+  }
+}
+
+auto FontCollectionTextMeasurer::set_shape_policy(ShapePolicy policy, std::size_t thread_count) -> void {
+  background_shaper.stop();
+
+  // reshape the text that was still in flight (on the layout thread)
+  for (const auto &job : background_shaper.take_all()) {
+    if (job->node != nullptr) {
+      job->node->text_data->shape_job = nullptr;
+      job->node->mark_paragraph_dirty();
+      job->node->mark_layout_dirty();
+    }
+  }
+
+  shape_policy = policy;
+  if (shape_policy == ShapePolicy::Estimate) {
+    background_shaper.start(font_mgr, std::max(thread_count, std::size_t{1}));
+  }
+}
+
+auto FontCollectionTextMeasurer::shape(Node *node, std::size_t worker) -> void {
+  auto &text_data = *node->text_data;
+  if (text_data.shape_job != nullptr) {
+    text_data.shape_job->node = nullptr;
+    text_data.shape_job = nullptr;
+  }
+  text_data.own_paragraph = nullptr;
+
+  // huge text is shaped a block at a time when it is painted (see `shape_block()`)
+  text_data.blocks = make_text_blocks(text_data.text);
+  if (text_data.blocks != nullptr) {
+    text_data.paragraph = nullptr;
+    return;
+  }
+
+  const auto build = [&](SharedParagraph &shared) {
+    if (is_simple_text_enabled) {
+      shared.simple_text = make_simple_text(text_data.text, node->style->font_size, default_typeface);
+    }
+    if (shared.simple_text == nullptr) {
+      shared.paragraph = make_paragraph(text_data.text, node->style->font_size, node->style->color, font_collections[worker]);
+      shared.color = node->style->color;
+      // NOTE: Skia shapes the text in the first layout, so it must run here with the font collection of this
+      //       worker. Later layouts from other workers only break the lines.
+      shared.memo.insert(shared.layout(std::numeric_limits<float>::infinity()));
+    }
+  };
+
+  // simple labels are cheap enough to lay out right away
+  if (shape_policy == ShapePolicy::Block || (is_simple_text_enabled && is_simple_text(text_data.text))) {
+    text_data.paragraph = shape_cache.get(text_data.text, node->style->font_size, build);
+    return;
+  }
+
+  // shaped before by another node
+  if (auto shared = shape_cache.find(text_data.text, node->style->font_size); shared != nullptr) {
+    text_data.paragraph = std::move(shared);
+    return;
+  }
+
+  // measured by `estimator` until `update()` takes the result
+  // NOTE: Nothing is drawn until then, the old paragraph would show the old text in the estimated box.
+  text_data.paragraph = nullptr;
+  text_data.shape_job = std::make_shared<ShapeJob>();
+  text_data.shape_job->node = node;
+  text_data.shape_job->text = text_data.text;
+  text_data.shape_job->font_size = node->style->font_size;
+  text_data.shape_job->color = node->style->color;
+  background_shaper.submit(text_data.shape_job);
+}
+
+auto FontCollectionTextMeasurer::measure(Node *node, float width) -> ParagraphMetrics {
+  if (node->text_data->shape_job != nullptr) {
+    return estimator.measure(node, width);
+  }
+
+  if (node->text_data->blocks != nullptr) {
+    auto metrics = ParagraphMetrics{.width = width};
+    for (auto &block : node->text_data->blocks->blocks) {
+      const auto block_metrics = measure_block(node, block, width);
+      metrics.longest_line = std::max(metrics.longest_line, block_metrics.longest_line);
+      metrics.height += block_metrics.height;
+      metrics.min_intrinsic_width = std::max(metrics.min_intrinsic_width, block_metrics.min_intrinsic_width);
+      metrics.max_intrinsic_width = std::max(metrics.max_intrinsic_width, block_metrics.max_intrinsic_width);
+    }
+    return metrics;
+  }
+
+  // other nodes with the same text may have been measured at this width (on other workers)
+  auto &shared = *node->text_data->paragraph;
+  auto lock = std::scoped_lock{shared.mutex};
+  if (const auto metrics = shared.memo.find(width); metrics != nullptr) {
+    return *metrics;
+  }
+
+  const auto metrics = shared.layout(width);
+  shared.memo.insert(metrics);
+  return metrics;
+}
+
+auto FontCollectionTextMeasurer::paint(Node *node, SkCanvas *canvas, SkPoint pos, float width) -> void {
+  auto &text_data = *node->text_data;
+  auto &shared = *text_data.paragraph;
+  const auto color = node->style->color;
+
+  // - Nodes at the width and color of the shared paragraph paint it as is.
+  // - The first node to paint it otherwise breaks the lines and recolors it.
+  // - The other nodes paint their own copy, so nodes with the same text do not break the lines of the shared
+  //   paragraph back and forth every frame. (the copy is shaped through the paragraph cache of the font collection)
+  if (shared.is_painted_as(width, color) || shared.painter == nullptr || shared.painter == node) {
+    if (!shared.is_painted_as(width, color)) {
+      shared.painter = node;
+    }
+    text_data.own_paragraph = nullptr;
+    shared.paint(canvas, pos.fX, pos.fY, width, color, text_data.text.length());
+    return;
+  }
+
+  if (text_data.own_paragraph == nullptr) {
+    text_data.own_paragraph = std::make_unique<SharedParagraph>();
+    if (shared.simple_text != nullptr) {
+      text_data.own_paragraph->simple_text = std::make_unique<SimpleText>(*shared.simple_text);
+    } else {
+      text_data.own_paragraph->paragraph =
+        make_paragraph(text_data.text, node->style->font_size, color, font_collections.front());
+      text_data.own_paragraph->color = color;
+    }
+  }
+  text_data.own_paragraph->paint(canvas, pos.fX, pos.fY, width, color, text_data.text.length());
+}
+
+auto FontCollectionTextMeasurer::shape_block(Node *node, TextBlock &block) -> void {
+  const auto text = std::string_view{node->text_data->text}.substr(block.begin, block.end - block.begin);
+  block.shaped = std::make_unique<SharedParagraph>();
+  if (is_simple_text_enabled) {
+    block.shaped->simple_text = make_simple_text(text, node->style->font_size, default_typeface);
+  }
+  if (block.shaped->simple_text == nullptr) {
+    block.shaped->paragraph = make_paragraph(text, node->style->font_size, node->style->color, font_collections.front());
+    block.shaped->color = node->style->color;
+  }
+}
+
+auto FontCollectionTextMeasurer::measure_block(Node *node, TextBlock &block, float width) -> ParagraphMetrics {
+  if (const auto metrics = block.memo.find(width); metrics != nullptr) {
+    return *metrics;
+  }
+
+  if (block.shaped != nullptr) {
+    const auto metrics = block.shaped->layout(width);
+    block.memo.insert(metrics);
+    return metrics;
+  }
+
+  // (a block dropped out of view is estimated again, it is resized once it is shaped)
+  const auto text = std::string_view{node->text_data->text}.substr(block.begin, block.end - block.begin);
+  const auto metrics = estimator.measure_text(text, node->style->font_size, width);
+  block.memo.insert(metrics);
+  block.is_estimated = true;
+  return metrics;
+}
+
+auto FontCollectionTextMeasurer::make_cell_font(float font_size) -> SkFont {
+  auto font = SkFont{monospace_typeface, font_size};
+  font.setSubpixel(true);
+  font.setEdging(SkFont::Edging::kAntiAlias);
+  return font;
+}
+
+auto FontCollectionTextMeasurer::find_cell_fallback(SkUnichar ch) -> sk_sp<SkTypeface> {
+  if (const auto it = cell_fallbacks.find(ch); it != cell_fallbacks.end()) {
+    return it->second;
+  }
+  auto typeface = font_mgr != nullptr ? font_mgr->matchFamilyStyleCharacter(nullptr, SkFontStyle{}, nullptr, 0, ch)
+                                      : nullptr;
+  cell_fallbacks.emplace(ch, typeface);
+  return typeface;
+}
+
+auto FontCollectionTextMeasurer::measure_cell(float font_size) -> SkSize {
+  const auto font = make_cell_font(font_size);
+  const auto glyph = font.unicharToGlyph('M');
+  auto advance = 0.f;
+  font.getWidths(&glyph, 1, &advance);
+
+  auto font_metrics = SkFontMetrics{};
+  font.getMetrics(&font_metrics);
+  return {advance, font_metrics.fDescent - font_metrics.fAscent + font_metrics.fLeading};
+}
+
+auto FontCollectionTextMeasurer::warm_up(std::span<const WarmUpText> texts) -> void {
+  if (!text_warmer.is_started()) {
+    text_warmer.start(this);
+  }
+  text_warmer.submit(texts);
+}
+
+auto FontCollectionTextMeasurer::warm_up_text(const sk_sp<skia::textlayout::FontCollection> &font_collection,
+                                              SkCanvas *canvas, const WarmUpText &text) -> void {
+  constexpr auto width = 512.f;
+  auto paint = SkPaint{text.color};
+  paint.setAntiAlias(true);
+
+  // grid cells are not shaped, only their glyphs are needed
+  if (text.is_grid) {
+    canvas->drawSimpleText(text.text.data(), text.text.length(), SkTextEncoding::kUTF8, 0, text.font_size,
+                           make_cell_font(text.font_size), paint);
+    return;
+  }
+
+  // (huge text is shaped a block at a time, see `shape_block()`)
+  if (text.text.length() >= TextBlocks::min_text_length) {
+    return;
+  }
+
+  // - Built the same way as `shape()` does, so the nodes with this text and font size take it from the cache.
+  // - Painted before it is put in the cache, where the layout may use it meanwhile.
+  auto simple_text = is_simple_text_enabled ? make_simple_text(text.text, text.font_size, default_typeface) : nullptr;
+  auto paragraph = std::unique_ptr<skia::textlayout::Paragraph>{};
+  if (simple_text != nullptr) {
+    simple_text->layout(width);
+    simple_text->paint(canvas, 0, 0, text.color);
+  } else {
+    paragraph = make_paragraph(text.text, text.font_size, text.color, font_collection);
+    paragraph->layout(width);
+    paragraph->paint(canvas, 0, 0);
+  }
+  shape_cache.get(text.text, text.font_size, [&](SharedParagraph &shared) {
+    shared.simple_text = std::move(simple_text);
+    shared.paragraph = std::move(paragraph);
+    shared.color = text.color;
+  });
+}
+
+auto FontCollectionTextMeasurer::shape_all(std::span<Node *const> nodes, ThreadPool *thread_pool) -> void {
+  // submitting is cheap, no need for the workers
+  if (shape_policy == ShapePolicy::Estimate) {
+    TextMeasurer::shape_all(nodes, nullptr);
+    return;
+  }
+  TextMeasurer::shape_all(nodes, thread_pool);
+}
+
+auto FontCollectionTextMeasurer::update() -> void {
+  for (const auto &job : background_shaper.take_done()) {
+    // deleted or reshaped since
+    if (job->node == nullptr) {
+      continue;
+    }
+
+    // (another node may have put the same text in the cache meanwhile)
+    auto &text_data = *job->node->text_data;
+    text_data.paragraph = shape_cache.insert(job->text, job->font_size, job->color, std::move(job->paragraph));
+    text_data.own_paragraph = nullptr;
+    text_data.paragraph_memo.clear();
+    {
+      auto lock = std::scoped_lock{text_data.paragraph->mutex};
+      text_data.paragraph->memo.insert(job->metrics);
+    }
+    text_data.shape_job = nullptr;
+    job->node->mark_layout_dirty();
+  }
+}
+
+auto StubTextMeasurer::shape(Node *, std::size_t) -> void {}
+
+auto StubTextMeasurer::measure(Node *node, float width) -> ParagraphMetrics {
+  return measure_text(node->text_data->text, node->style->font_size, width);
+}
+
+auto StubTextMeasurer::measure_cell(float font_size) -> SkSize {
+  return {font_size * advance, font_size * line_height};
+}
+
+auto StubTextMeasurer::measure_text(std::string_view text, float font_size, float width) -> ParagraphMetrics {
+  const auto char_width = font_size * advance;
+  const auto space_width = char_width;
+
+  auto metrics = ParagraphMetrics{.width = width};
+  auto line_count = 1;
+  auto line_width = 0.f;      // width of the current wrapped line
+  auto hard_line_width = 0.f; // width of the current line without wrapping
+  auto word_width = 0.f;
+
+  const auto end_word = [&] {
+    metrics.min_intrinsic_width = std::max(metrics.min_intrinsic_width, word_width);
+    if (line_width > 0 && line_width + space_width + word_width > width) {
+      metrics.longest_line = std::max(metrics.longest_line, line_width);
+      line_width = word_width;
+      ++line_count;
+    } else {
+      line_width += (line_width > 0 ? space_width : 0) + word_width;
+    }
+    word_width = 0;
+  };
+  const auto end_line = [&] {
+    metrics.longest_line = std::max(metrics.longest_line, line_width);
+    metrics.max_intrinsic_width = std::max(metrics.max_intrinsic_width, hard_line_width);
+    line_width = 0;
+    hard_line_width = 0;
+  };
+
+  for (const auto c : text) {
+    // count code points, not bytes
+    if (((unsigned char)c & 0xC0) == 0x80) {
+      continue;
+    }
+    switch (c) {
+    case ' ':
+      end_word();
+      hard_line_width += space_width;
+      break;
+    case '\n':
+      end_word();
+      end_line();
+      ++line_count;
+      break;
+    default:
+      word_width += char_width;
+      hard_line_width += char_width;
+      break;
+    }
+  }
+  end_word();
+  end_line();
+
+  metrics.height = (float)line_count * font_size * line_height;
+  return metrics;
+}
+
+} // namespace rugui
@@ -0,0 +1,327 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <include/core/SkFont.h>
+#include <include/core/SkFontMgr.h>
+#include <include/core/SkPoint.h>
+#include <include/core/SkSize.h>
+#include <include/core/SkTextBlob.h>
+#include <modules/skparagraph/include/FontCollection.h>
+#include <modules/skparagraph/include/Paragraph.h>
+
+namespace rugui {
+
+struct Node;
+struct ThreadPool;
+
+struct ParagraphMetrics {
+  float width = 0; // Width constraint of the layout.
+  float longest_line = 0;
+  float height = 0;
+  float min_intrinsic_width = 0;
+  float max_intrinsic_width = 0;
+};
+
+// Line breaking results of a paragraph for the most recently used width constraints.
+struct ParagraphMemo {
+  static constexpr auto capacity = std::size_t{8};
+
+  std::array<ParagraphMetrics, capacity> entries;
+  std::size_t size = 0;
+  std::size_t next = 0;
+
+  auto find(float width) -> const ParagraphMetrics *;
+  auto insert(const ParagraphMetrics &metrics) -> void;
+  auto clear() -> void;
+};
+
+// Printable ascii text laid out with a single font run, without the paragraph machinery.
+// NOTE: No kerning or ligatures, lines break at spaces.
+struct SimpleText {
+  struct Line {
+    std::uint32_t begin = 0;
+    std::uint32_t end = 0; // (trailing spaces excluded)
+  };
+
+  std::string text;
+  SkFont font;
+  std::vector<SkGlyphID> glyphs; // (one per character)
+  std::vector<float> offsets; // X of each glyph from the start of the text. (one past the last glyph)
+  float ascent = 0;           // (negative)
+  float line_height = 0;
+
+  std::vector<Line> lines;
+  sk_sp<SkTextBlob> blob; // Lines positioned for painting. (built on the first paint after a layout)
+
+  auto layout(float width) -> ParagraphMetrics;
+  auto paint(SkCanvas *canvas, float x, float y, SkColor4f color) -> void;
+};
+
+auto is_simple_text(std::string_view text) -> bool;
+// Null if the text needs the paragraph. (bidi, fallback fonts, line breaks, ...)
+auto make_simple_text(std::string_view text, float font_size, const sk_sp<SkTypeface> &typeface)
+  -> std::unique_ptr<SimpleText>;
+
+// A paragraph shaped once for every text node with the same text and font. (see `ShapeCache`)
+// NOTE: The lines are broken at the width of the node that used it last, painting breaks them again if needed.
+struct SharedParagraph {
+  std::unique_ptr<skia::textlayout::Paragraph> paragraph; // (null until built)
+  std::unique_ptr<SimpleText> simple_text;                // Set instead of `paragraph` for simple labels.
+  std::mutex mutex;                                       // Held while building and breaking lines. (layout workers)
+  SkColor4f color = SkColors::kBlack;                     // Color of the foreground paint.
+  float width = std::numeric_limits<float>::quiet_NaN();  // Width the lines are currently broken at.
+  ParagraphMemo memo;                                     // (shared by every node that uses the paragraph)
+  const Node *painter = nullptr; // Node that may break the lines and recolor it for painting. (only compared)
+
+  auto is_built() const -> bool;
+  // Painted as is at the width and color. (without breaking the lines again)
+  auto is_painted_as(float width, SkColor4f color) const -> bool;
+  auto layout(float width) -> ParagraphMetrics;
+  auto paint(SkCanvas *canvas, float x, float y, float width, SkColor4f color, std::size_t text_length) -> void;
+};
+
+// Lines of a huge text, shaped only while they are painted.
+struct TextBlock {
+  std::uint32_t begin = 0; // Range in the text. (without the line break that ends the block)
+  std::uint32_t end = 0;
+  std::unique_ptr<SharedParagraph> shaped; // (null while out of view)
+  ParagraphMemo memo;                      // Sizes the layout uses.
+  bool is_estimated = true;                // `memo` holds estimated sizes. (until the layout after it is shaped)
+  std::uint64_t paint_count = 0;           // `TextBlocks::paint_count` when it was last painted.
+};
+
+// A huge text split into blocks at line breaks, so the lines out of view are neither shaped nor painted.
+struct TextBlocks {
+  static constexpr auto min_text_length = std::size_t{64} << 10;  // Shorter text is not split.
+  static constexpr auto block_length = std::size_t{4} << 10;      // (split at the next line break)
+  static constexpr auto max_block_length = std::size_t{16} << 10; // Longer lines are split at a space.
+  static constexpr auto max_shaped_blocks = std::size_t{32};      // Shaped blocks kept out of view.
+
+  std::vector<TextBlock> blocks;
+  std::uint64_t paint_count = 0;
+};
+
+// Null if the text is short enough to be shaped as a whole.
+auto make_text_blocks(std::string_view text) -> std::unique_ptr<TextBlocks>;
+
+// Code point at `i` of utf-8 text, `i` is moved past it. (an invalid sequence is U+FFFD)
+auto next_utf8(std::string_view text, std::size_t &i) -> SkUnichar;
+
+// Paragraphs shared by all text nodes, so a label that is repeated many times is shaped once.
+// NOTE: Least recently used paragraphs are evicted past `byte_budget`, nodes keep the paragraph they hold.
+struct ShapeCache {
+  static constexpr auto bytes_per_char = std::size_t{64}; // Estimated size of a shaped character.
+
+  std::size_t byte_budget = std::size_t{8} << 20;
+
+private:
+  struct Key {
+    std::string text;
+    float font_size = 0;
+
+    auto operator==(const Key &) const -> bool = default;
+  };
+  struct KeyHash {
+    auto operator()(const Key &key) const -> std::size_t;
+  };
+  struct Entry {
+    Key key;
+    std::shared_ptr<SharedParagraph> paragraph;
+    std::size_t bytes = 0;
+  };
+
+  std::mutex mutex;
+  std::list<Entry> entries; // (most recently used first)
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+  std::size_t bytes = 0;
+
+  auto get_entry(std::string_view text, float font_size) -> std::shared_ptr<SharedParagraph>;
+
+public:
+  // Shared paragraph of the text, `build` is called if it was not built yet. (thread safe)
+  auto get(std::string_view text, float font_size, const std::function<void(SharedParagraph &)> &build)
+    -> std::shared_ptr<SharedParagraph>;
+  // Shared paragraph of the text, `paragraph` is used if it was not built yet. (thread safe)
+  auto insert(std::string_view text, float font_size, SkColor4f color,
+              std::unique_ptr<skia::textlayout::Paragraph> paragraph) -> std::shared_ptr<SharedParagraph>;
+  // Shared paragraph of the text if it was built. (thread safe)
+  auto find(std::string_view text, float font_size) -> std::shared_ptr<SharedParagraph>;
+
+  auto get_byte_count() -> std::size_t;
+  auto clear() -> void;
+};
+
+enum class ShapePolicy {
+  Block,    // Wait for the text to be shaped. (default)
+  Estimate, // Lay out with an estimated size while the text is shaped in the background, then lay out again.
+            // (the text is not drawn until it is shaped)
+};
+
+// Text shaped by `BackgroundShaper`.
+struct ShapeJob {
+  Node *node = nullptr; // (null once the node was deleted or reshaped, only accessed by the layout thread)
+  std::string text;
+  float font_size = 0;
+  SkColor4f color;
+
+  std::unique_ptr<skia::textlayout::Paragraph> paragraph;
+  ParagraphMetrics metrics; // (laid out at an infinite width)
+  std::atomic<bool> is_done = false;
+};
+
+// Shapes paragraphs on its own threads, each with its own font collection.
+struct BackgroundShaper {
+private:
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable work_cv;
+  std::deque<std::shared_ptr<ShapeJob>> queue;
+  std::vector<std::shared_ptr<ShapeJob>> jobs; // Submitted and not yet taken by `take_done()`.
+  bool is_stopping = false;
+
+public:
+  BackgroundShaper() = default;
+  BackgroundShaper(const BackgroundShaper &) = delete;
+  auto operator=(const BackgroundShaper &) -> BackgroundShaper & = delete;
+  ~BackgroundShaper();
+
+  auto start(sk_sp<SkFontMgr> font_mgr, std::size_t thread_count) -> void;
+  auto stop() -> void;
+  auto is_started() -> bool;
+
+  auto submit(std::shared_ptr<ShapeJob> job) -> void;
+  auto take_done() -> std::vector<std::shared_ptr<ShapeJob>>;
+  auto take_all() -> std::vector<std::shared_ptr<ShapeJob>>;
+};
+
+// Text that will be shown soon. (see `FontCollectionTextMeasurer::warm_up`)
+struct WarmUpText {
+  std::string text;
+  float font_size = 20.f;
+  SkColor4f color = SkColors::kBlack;
+  bool is_grid = false; // Shown in the cells of a grid node.
+};
+
+struct FontCollectionTextMeasurer;
+
+// Shapes and paints text on its own thread, with its own font collection, before the text is shown.
+struct TextWarmer {
+private:
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable work_cv;
+  std::condition_variable idle_cv;
+  std::deque<WarmUpText> queue;
+  bool is_busy = false; // A text was taken from the queue and is not done yet.
+  bool is_stopping = false;
+
+public:
+  TextWarmer() = default;
+  TextWarmer(const TextWarmer &) = delete;
+  auto operator=(const TextWarmer &) -> TextWarmer & = delete;
+  ~TextWarmer();
+
+  auto start(FontCollectionTextMeasurer *text_measurer) -> void;
+  auto stop() -> void;
+  auto is_started() -> bool;
+
+  auto submit(std::span<const WarmUpText> texts) -> void;
+  // Block until the submitted text is warmed up.
+  auto wait() -> void;
+};
+
+// Measures the text of text nodes for the layout.
+// NOTE: Called from layout workers, `worker` is the index of the calling worker.
+struct TextMeasurer {
+  virtual ~TextMeasurer() = default;
+
+  // Prepare the node for `measure()` after its text or font changed.
+  virtual auto shape(Node *node, std::size_t worker) -> void = 0;
+  // Break the lines of the node at `width`.
+  virtual auto measure(Node *node, float width) -> ParagraphMetrics = 0;
+  // Size of a cell of a grid node. (one advance of the monospace font by one line)
+  virtual auto measure_cell(float font_size) -> SkSize = 0;
+
+  // Shape the nodes whose text or font changed before the layout measures them. (spread over the workers)
+  virtual auto shape_all(std::span<Node *const> nodes, ThreadPool *thread_pool) -> void;
+  // Apply the results of background work, nodes that changed are marked dirty. (called before the layout)
+  virtual auto update() -> void {}
+};
+
+auto make_paragraph(std::string_view text, float font_size, SkColor4f color,
+                    const sk_sp<skia::textlayout::FontCollection> &font_collection)
+  -> std::unique_ptr<skia::textlayout::Paragraph>;
+
+// Measures text without shaping: every character has the same advance and lines break at spaces.
+// Useful for tests and benchmarks.
+struct StubTextMeasurer : TextMeasurer {
+  float advance = 0.5f;     // (relative to font size)
+  float line_height = 1.2f; // (relative to font size)
+
+  auto shape(Node *node, std::size_t worker) -> void override;
+  auto measure(Node *node, float width) -> ParagraphMetrics override;
+  auto measure_cell(float font_size) -> SkSize override;
+  auto measure_text(std::string_view text, float font_size, float width) -> ParagraphMetrics;
+};
+
+// Shapes text into a skia paragraph that is also used for painting.
+struct FontCollectionTextMeasurer : TextMeasurer {
+  sk_sp<SkFontMgr> font_mgr = nullptr;
+  std::vector<sk_sp<skia::textlayout::FontCollection>> font_collections; // (indexed by worker)
+
+  ShapeCache shape_cache;
+  sk_sp<SkTypeface> default_typeface = nullptr;   // Typeface of the paragraphs. (used by `SimpleText`)
+  sk_sp<SkTypeface> monospace_typeface = nullptr; // Typeface of grid nodes.
+  std::unordered_map<SkUnichar, sk_sp<SkTypeface>> cell_fallbacks; // (looked up once per character, painting only)
+  bool is_simple_text_enabled = true;
+
+  ShapePolicy shape_policy = ShapePolicy::Block;
+  BackgroundShaper background_shaper; // (started by `set_shape_policy`)
+  StubTextMeasurer estimator;         // Size of the text while it is shaped in the background.
+  TextWarmer text_warmer;             // (started by `warm_up`)
+
+  // Create a font collection for each worker. (font collections are not thread safe)
+  auto init(sk_sp<SkFontMgr> font_mgr, std::size_t worker_count) -> void;
+  auto set_shape_policy(ShapePolicy policy, std::size_t thread_count = 2) -> void;
+
+  auto shape(Node *node, std::size_t worker) -> void override;
+  auto measure(Node *node, float width) -> ParagraphMetrics override;
+  auto measure_cell(float font_size) -> SkSize override;
+  auto shape_all(std::span<Node *const> nodes, ThreadPool *thread_pool) -> void override;
+  auto update() -> void override;
+
+  // Paint the paragraph of a text node. (not thread safe, uses the font collection of worker 0)
+  // NOTE: A node paints its own copy when the shared paragraph is painted at another width or color.
+  auto paint(Node *node, SkCanvas *canvas, SkPoint pos, float width) -> void;
+  // Shape a block of a huge text before it is painted. (not thread safe, uses the font collection of worker 0)
+  auto shape_block(Node *node, TextBlock &block) -> void;
+  auto measure_block(Node *node, TextBlock &block, float width) -> ParagraphMetrics;
+
+  // Font the cells of grid nodes are drawn with. (thread safe)
+  auto make_cell_font(float font_size) -> SkFont;
+  // Typeface for a character of a grid cell that the cell font has no glyph for. (null if no font has it)
+  auto find_cell_fallback(SkUnichar ch) -> sk_sp<SkTypeface>;
+
+  // Shape and paint the text in the background, so the first frame that shows it does not wait for the typeface and
+  // fallback lookups, the shaping or the glyph rasterization. (the shaped text is put in `shape_cache`)
+  // NOTE: Text that is still queued is dropped by `init()`.
+  auto warm_up(std::span<const WarmUpText> texts) -> void;
+  auto warm_up_text(const sk_sp<skia::textlayout::FontCollection> &font_collection, SkCanvas *canvas,
+                    const WarmUpText &text) -> void;
+};
+
+} // namespace rugui
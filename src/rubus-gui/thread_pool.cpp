@@ -0,0 +1,122 @@
+#include "thread_pool.hpp"
+
+namespace rugui {
+
+ThreadPool::~ThreadPool() {
+  stop();
+}
+
+auto ThreadPool::start(std::size_t thread_count) -> void {
+  stop();
+
+  queues.clear();
+  for (auto i = std::size_t{}; i < thread_count + 1; ++i) {
+    queues.push_back(std::make_unique<Queue>());
+  }
+
+  is_stopping = false;
+  for (auto i = std::size_t{}; i < thread_count; ++i) {
+    threads.emplace_back([this, worker = i + 1] {
+      auto seen_generation = std::size_t{};
+      while (true) {
+        {
+          auto lock = std::unique_lock{mutex};
+          work_cv.wait(lock, [&] { return is_stopping || generation != seen_generation; });
+          if (is_stopping) {
+            return;
+          }
+          seen_generation = generation;
+        }
+        work(worker);
+      }
+    });
+  }
+}
+
+auto ThreadPool::stop() -> void {
+  {
+    auto lock = std::scoped_lock{mutex};
+    is_stopping = true;
+  }
+  work_cv.notify_all();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  threads.clear();
+}
+
+auto ThreadPool::get_worker_count() -> std::size_t {
+  return threads.size() + 1;
+}
+
+auto ThreadPool::run(std::size_t count, const Task &task) -> void {
+  if (count == 0) {
+    return;
+  }
+
+  // not started or nothing to share
+  if (threads.empty() || count == 1) {
+    for (auto i = std::size_t{}; i < count; ++i) {
+      task(i, 0);
+    }
+    return;
+  }
+
+  this->task = &task;
+  pending = count;
+  for (auto i = std::size_t{}; i < count; ++i) {
+    auto &queue = *queues[i % queues.size()];
+    auto lock = std::scoped_lock{queue.mutex};
+    queue.indices.push_back(i);
+  }
+  {
+    auto lock = std::scoped_lock{mutex};
+    ++generation;
+  }
+  work_cv.notify_all();
+
+  work(0);
+
+  auto lock = std::unique_lock{mutex};
+  done_cv.wait(lock, [&] { return pending == 0; });
+  this->task = nullptr;
+}
+
+auto ThreadPool::take(std::size_t worker, std::size_t &index) -> bool {
+  // own queue from the back
+  {
+    auto &queue = *queues[worker];
+    auto lock = std::scoped_lock{queue.mutex};
+    if (!queue.indices.empty()) {
+      index = queue.indices.back();
+      queue.indices.pop_back();
+      return true;
+    }
+  }
+
+  // steal from the front of the others
+  for (auto i = std::size_t{1}; i < queues.size(); ++i) {
+    auto &queue = *queues[(worker + i) % queues.size()];
+    auto lock = std::scoped_lock{queue.mutex};
+    if (!queue.indices.empty()) {
+      index = queue.indices.front();
+      queue.indices.pop_front();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+auto ThreadPool::work(std::size_t worker) -> void {
+  auto index = std::size_t{};
+  while (take(worker, index)) {
+    (*task)(index, worker);
+    if (--pending == 0) {
+      auto lock = std::scoped_lock{mutex};
+      done_cv.notify_all();
+    }
+  }
+}
+
+} // namespace rugui
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rugui {
+
+// Work-stealing thread pool. Each worker owns a queue and steals from the others when it runs dry.
+// The thread calling `run()` works as worker 0.
+struct ThreadPool {
+  using Task = std::function<void(std::size_t index, std::size_t worker)>;
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::size_t> indices;
+  };
+
+  std::vector<std::thread> threads;
+  std::vector<std::unique_ptr<Queue>> queues; // (indexed by worker)
+
+  std::mutex mutex;
+  std::condition_variable work_cv;
+  std::condition_variable done_cv;
+  std::size_t generation = 0;
+  bool is_stopping = false;
+
+  const Task *task = nullptr;
+  std::atomic<std::size_t> pending = 0;
+
+public:
+  ThreadPool() = default;
+  ThreadPool(const ThreadPool &) = delete;
+  auto operator=(const ThreadPool &) -> ThreadPool & = delete;
+  ~ThreadPool();
+
+  auto start(std::size_t thread_count) -> void;
+  auto stop() -> void;
+  auto get_worker_count() -> std::size_t;
+
+  // Calls `task` for every index in `[0, count)` and returns after all calls are finished.
+  // NOTE: Must not be called from inside a task.
+  auto run(std::size_t count, const Task &task) -> void;
+
+private:
+  auto take(std::size_t worker, std::size_t &index) -> bool;
+  auto work(std::size_t worker) -> void;
+};
+
+} // namespace rugui
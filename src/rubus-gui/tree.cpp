@@ -3,7 +3,17 @@
 namespace rugui {
 
 Tree::Tree() {
+  // nodes can be deleted by the library, so the tree never keeps a pointer to a deleted node
+  layout_store.on_release = [this](Node *node) {
+    if (node_under_mouse == node) {
+      node_under_mouse = nullptr;
+    }
+    if (node_mouse_down == node) {
+      node_mouse_down = nullptr;
+    }
+  };
   root = (new Node{"root"})->set_color(SkColors::kTransparent);
+  root->attach(&layout_store);
 }
 
 Tree::~Tree() {
@@ -27,8 +37,26 @@ auto Tree::reset() -> void {
 }
 
 auto Tree::set_size(Screen *screen) -> void {
-  root->style.width = {SizeMode::Self, (float)screen->width};
-  root->style.height = {SizeMode::Self, (float)screen->height};
+  const auto width = Size{SizeMode::Self, (float)screen->width};
+  const auto height = Size{SizeMode::Self, (float)screen->height};
+  if (root->style->width.mode != width.mode || root->style->width.value != width.value ||
+      root->style->height.mode != height.mode || root->style->height.value != height.value) {
+    root->set_width(width);
+    root->set_height(height);
+  }
+}
+
+auto Tree::set_pixel_snap(bool value) -> void {
+  if (layout_store.is_pixel_snapped == value) {
+    return;
+  }
+  layout_store.is_pixel_snapped = value;
+
+  // every position has to be resolved again
+  root->dfs([](Node *node) -> Node::Traverse {
+    node->is_layout_dirty = true;
+    return Node::Traverse::Continue;
+  });
 }
 
 auto Tree::run_mouse_event(int mouse_x, int mouse_y) -> void {
@@ -39,7 +67,7 @@ auto Tree::run_mouse_event(int mouse_x, int mouse_y) -> void {
   const auto prev_node_under_mouse = node_under_mouse;
 
   root->dfs([&](Node *node) -> Node::Traverse {
-    if (node->output.style.display_mode == DisplayMode::Collapsed) {
+    if (node->display_mode == DisplayMode::Collapsed) {
       return Node::Traverse::SkipChildren;
     }
     if (node->check_mouse_inside(mouse_x, mouse_y)) {
@@ -109,20 +137,20 @@ auto Tree::run_vscroll_event(int delta_y) -> void {
   if (node_under_mouse != nullptr) {
     auto node = node_under_mouse;
     while (node != nullptr) {
-      if (node->output.content_overflow.fHeight > 0) {
-        const auto min_y = -node->output.content_overflow.fHeight;
+      if (layout_store.content_overflow[node->id].fHeight > 0) {
+        const auto min_y = -layout_store.content_overflow[node->id].fHeight;
         const auto max_y = 0.f;
 
-        if (node->style.vscroll_amount == min_y && delta_y < 0) {
+        if (node->vscroll_amount == min_y && delta_y < 0) {
           node = node->parent;
           continue;
         }
-        if (node->style.vscroll_amount == max_y && delta_y > 0) {
+        if (node->vscroll_amount == max_y && delta_y > 0) {
           node = node->parent;
           continue;
         }
 
-        node->style.vscroll_amount = std::clamp(node->style.vscroll_amount + (float)delta_y, min_y, max_y);
+        node->vscroll_amount = std::clamp(node->vscroll_amount + (float)delta_y, min_y, max_y);
         break;
       }
       node = node->parent;
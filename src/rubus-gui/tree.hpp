@@ -6,6 +6,7 @@
 namespace rugui {
 
 struct Tree {
+  LayoutStore layout_store;
   Node *root = nullptr;
 
   bool is_mouse_button_enabled = true;
@@ -16,11 +17,14 @@ struct Tree {
   Node *node_mouse_down = nullptr;
 
   Tree();
+  Tree(const Tree &) = delete;
+  auto operator=(const Tree &) -> Tree & = delete;
   ~Tree();
 
   auto init(Screen *screen) -> void;
   auto reset() -> void;
   auto set_size(Screen *screen) -> void;
+  auto set_pixel_snap(bool value) -> void;
 
   auto run_mouse_event(int mouse_x, int mouse_y) -> void;
   auto run_mouse_leave_window_event(int mouse_x, int mouse_y) -> void;